@@ -0,0 +1,155 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// Headless throughput benchmark: replays captured host output through
+// termcore and the renderer, drawing into in-memory bit planes.
+//
+// Capture with for example:
+//   ls -lR --color=always /usr > ls.cap
+//   script -q -c 'vim -c q big.c' vim.cap
+// then run ./bench [-c chunk] [-n repeat] ls.cap vim.cap ...
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pico/stdlib.h"
+#include "../el.h"
+#include "../termcore.h"
+#include "../graphics.h"
+#include "../terminal.h"
+#include "../prof.h"
+
+unsigned char framebuf_bp0[SCR_STRIDE * SCR_BUF_HEIGHT] __attribute__((aligned(4)));
+unsigned char framebuf_bp1[SCR_STRIDE * SCR_BUF_HEIGHT] __attribute__((aligned(4)));
+volatile bool frame_sync = false;
+volatile int frame_scroll_lines = 0;
+
+// Replies to the host go nowhere
+size_t serial_write(const uint8_t *buf, size_t len) {
+    return len;
+}
+
+void serial_putc(char c) {
+}
+
+void serial_puts(char *s) {
+}
+
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Feed the data in chunks like term_loop() does, drawing everything
+// after each chunk when render is set. Returns the time taken.
+static double bench_run(const uint8_t *data, size_t size, size_t chunk,
+        bool render) {
+    term_full_reset();
+    while (render && (term_update_screen() || term_state_dirty));
+
+    double start = bench_now();
+    for (size_t pos = 0; pos < size; pos += chunk) {
+        size_t len = (size - pos < chunk) ? (size - pos) : chunk;
+        term_process_buffer(data + pos, len);
+        while (render && (term_update_screen() || term_state_dirty));
+    }
+    return bench_now() - start;
+}
+
+static void bench_report(const char *name, size_t bytes, double secs) {
+    printf("  %-14s %9.2f MB/s %9.1f ns/byte\n", name,
+            bytes / secs / 1e6, secs * 1e9 / bytes);
+}
+
+static int bench_file(const char *path, size_t chunk, int repeat) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+        fprintf(stderr, "%s: empty or unreadable\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+
+    double parse = 0.0;
+    double render = 0.0;
+    uint32_t cells = 0;
+    for (int i = 0; i < repeat; i++) {
+        parse += bench_run(data, size, chunk, false);
+        uint32_t drawn = prof_data.counters[PROF_CELLS_DRAWN];
+        render += bench_run(data, size, chunk, true);
+        cells += prof_data.counters[PROF_CELLS_DRAWN] - drawn;
+    }
+    munmap((void *)data, size);
+
+    size_t bytes = size * repeat;
+    printf("%s: %zu bytes x %d, %zu byte chunks\n", path, size, repeat, chunk);
+    bench_report("parse", bytes, parse);
+    bench_report("parse+render", bytes, render);
+    printf("  %-14s %9.2f Mcells/s %7.1f cells/KB\n", "cells drawn",
+            cells / render / 1e6, cells * 1024.0 / bytes);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t chunk = 64;
+    int repeat = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:")) != -1) {
+        if (opt == 'c')
+            chunk = strtoul(optarg, NULL, 0);
+        else if (opt == 'n')
+            repeat = atoi(optarg);
+        else
+            break;
+    }
+    if ((optind == argc) || (chunk == 0) || (repeat <= 0)) {
+        fprintf(stderr, "Usage: %s [-c chunk] [-n repeat] capture...\n",
+                argv[0]);
+        return 1;
+    }
+
+    term_init();
+    int result = 0;
+    for (int i = optind; i < argc; i++) {
+        if (bench_file(argv[i], chunk, repeat) < 0)
+            result = 1;
+    }
+    return result;
+}
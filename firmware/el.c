@@ -30,6 +30,7 @@
 #include "eldata.pio.h"
 #include "graphics.h"
 #include "el.h"
+#include "prof.h"
 
 PIO el_pio = pio0;
 // Uses 3 DMA channels: The RP2040 DMA doesn't support list, so using chainning
@@ -37,8 +38,9 @@ PIO el_pio = pio0;
 // the last is for the half screen that crosses the boundary.
 int el_udma_chan, el_ldma_chan, el_wrap_chan;
 
-unsigned char framebuf_bp0[SCR_STRIDE * SCR_BUF_HEIGHT];
-unsigned char framebuf_bp1[SCR_STRIDE * SCR_BUF_HEIGHT];
+// Word aligned for DMA and word stores
+unsigned char framebuf_bp0[SCR_STRIDE * SCR_BUF_HEIGHT] __attribute__((aligned(4)));
+unsigned char framebuf_bp1[SCR_STRIDE * SCR_BUF_HEIGHT] __attribute__((aligned(4)));
 
 static int frame_state = 0;
 volatile int frame_scroll_lines = 0;
@@ -81,6 +83,7 @@ static void el_dma_config_chainning(uint chan, uint chain_to) {
 static void el_pio_irq_handler() {
     uint8_t *framebuf = frame_state ? framebuf_bp0 : framebuf_bp1;
     frame_state = !frame_state;
+    prof_count(PROF_DMA_RECONFIG, 1);
 
     if (frame_scroll_lines >= SCR_BUF_HEIGHT) {
         frame_scroll_lines = frame_scroll_lines % SCR_BUF_HEIGHT;
@@ -20,7 +20,11 @@
 // SOFTWARE.
 //
 #include <stdio.h>
+#include <string.h>
 #include "pico/stdlib.h"
+#if PICO_ON_DEVICE
+#include "hardware/dma.h"
+#endif
 #include "el.h"
 #include "font.h"
 #include "graphics.h"
@@ -28,6 +32,40 @@
 //#define GREYSCALE_3FRAME
 #define GREYSCALE_2FRAME
 
+#if PICO_ON_DEVICE
+// Solid fills and line copies run on one DMA channel per bit plane while
+// the CPU goes on. Everything else touching the frame buffer waits for
+// them first.
+static int graph_dma_chan[2] = {-1, -1};
+static bool graph_dma_busy = false;
+// Read without increment by fills
+static uint32_t graph_fill_word[2];
+
+static inline void graph_dma_wait() {
+    if (graph_dma_busy) {
+        dma_channel_wait_for_finish_blocking(graph_dma_chan[0]);
+        dma_channel_wait_for_finish_blocking(graph_dma_chan[1]);
+        graph_dma_busy = false;
+    }
+}
+
+static void graph_dma_start(int plane, void *dst, const void *src,
+        size_t len, bool read_increment) {
+    if (graph_dma_chan[plane] < 0)
+        graph_dma_chan[plane] = dma_claim_unused_channel(true);
+    int chan = graph_dma_chan[plane];
+    dma_channel_config c = dma_channel_get_default_config(chan);
+    bool words = !(((uintptr_t)dst | (uintptr_t)src | len) & 3);
+    channel_config_set_transfer_data_size(&c, words ? DMA_SIZE_32 : DMA_SIZE_8);
+    channel_config_set_read_increment(&c, read_increment);
+    channel_config_set_write_increment(&c, true);
+    dma_channel_configure(chan, &c, dst, src, words ? (len / 4) : len, true);
+    graph_dma_busy = true;
+}
+#else
+static inline void graph_dma_wait() {}
+#endif
+
 static void _putpixel_bp(unsigned char *buf, int x, int y, int c) {
     if (c)
         buf[SCR_STRIDE * y + x / 8] |= 1 << (x % 8);
@@ -36,6 +74,7 @@ static void _putpixel_bp(unsigned char *buf, int x, int y, int c) {
 }
 
 void graph_put_pixel(int x, int y, int c) {
+    graph_dma_wait();
 #ifdef GREYSCALE_3FRAME
     if (c == 3) {
         _putpixel_bp(framebuf_bp0, x, y, 1);
@@ -125,6 +164,21 @@ static uint8_t bp1_masks_odd[8] = {0x00, 0x00, 0xaa, 0x55, 0x55, 0xff, 0xff, 0xf
 static uint8_t bp1_masks_even[8]= {0x00, 0x00, 0x55, 0xaa, 0xaa, 0xff, 0xff, 0xff};
 
 void graph_fill_rect(int x1, int y1, int x2, int y2, int c) {
+    graph_dma_wait();
+#if PICO_ON_DEVICE
+    if ((x1 == 0) && (x2 == SCR_WIDTH) && (bp0_masks_odd[c] == bp0_masks_even[c])
+            && (bp1_masks_odd[c] == bp1_masks_even[c])) {
+        // Whole lines of a solid color are one block per plane
+        size_t len = (y2 - y1) * SCR_STRIDE;
+        graph_fill_word[0] = bp0_masks_odd[c] * 0x01010101u;
+        graph_fill_word[1] = bp1_masks_odd[c] * 0x01010101u;
+        graph_dma_start(0, framebuf_bp0 + y1 * SCR_STRIDE, &graph_fill_word[0],
+                len, false);
+        graph_dma_start(1, framebuf_bp1 + y1 * SCR_STRIDE, &graph_fill_word[1],
+                len, false);
+        return;
+    }
+#endif
     if (((x1 % 8) == 0) && ((x2 % 8) == 0) && ((y1 % 2) == 0) && ((y2 % 2) == 0)) {
         uint8_t bp0_mask_odd  = bp0_masks_odd[c];
         uint8_t bp0_mask_even = bp0_masks_even[c];
@@ -151,6 +205,27 @@ void graph_fill_rect(int x1, int y1, int x2, int y2, int c) {
     }
 }
 
+// Copy h scan lines starting at src_y to dst_y, ranges may overlap
+void graph_copy_lines(int dst_y, int src_y, int h) {
+    graph_dma_wait();
+#if PICO_ON_DEVICE
+    // DMA copies upwards, which is only safe for overlapping ranges when
+    // moving data down in memory
+    if ((dst_y < src_y) || (dst_y >= src_y + h)) {
+        size_t len = h * SCR_STRIDE;
+        graph_dma_start(0, framebuf_bp0 + dst_y * SCR_STRIDE,
+                framebuf_bp0 + src_y * SCR_STRIDE, len, true);
+        graph_dma_start(1, framebuf_bp1 + dst_y * SCR_STRIDE,
+                framebuf_bp1 + src_y * SCR_STRIDE, len, true);
+        return;
+    }
+#endif
+    memmove(framebuf_bp0 + dst_y * SCR_STRIDE, framebuf_bp0 + src_y * SCR_STRIDE,
+            h * SCR_STRIDE);
+    memmove(framebuf_bp1 + dst_y * SCR_STRIDE, framebuf_bp1 + src_y * SCR_STRIDE,
+            h * SCR_STRIDE);
+}
+
 void graph_put_mono(int x, int y, int width, int height, char *pimage, char cl_fg, char cl_bg)
 {
 	int i,j,k,pixel,rx=0,ry=0;
@@ -200,22 +275,30 @@ static uint8_t graph_text_processing(uint8_t p, int y, char flags) {
     return p;
 }
 
-void graph_put_char(int x, int y, char c, char cl_fg, char cl_bg, char flags) {
+// Flags that change how a glyph looks, blinking is handled by redrawing
+#define GLYPH_RENDER_FLAGS (FLAG_BOLD | FLAG_ITALIC | FLAG_UNDERLINE | FLAG_STHROUGH)
+
+// Cache of glyphs already expanded into bitplane bytes, keyed by char, flags
+// and colors. 4-way set associative, LRU replaced. 64 sets use 10KB of SRAM.
+#define GLYPH_CACHE_SET_BITS 6
+#define GLYPH_CACHE_SETS (1 << GLYPH_CACHE_SET_BITS)
+#define GLYPH_CACHE_WAYS 4
+
+typedef struct {
+    uint32_t key;
+    uint32_t last_used;
+    uint8_t bp0[16];
+    uint8_t bp1[16];
+} GLYPH_CACHE_ENTRY;
+
+static GLYPH_CACHE_ENTRY glyph_cache[GLYPH_CACHE_SETS][GLYPH_CACHE_WAYS];
+static uint32_t glyph_cache_tick;
+
+// Render a glyph cell into 16 rows of bitplane bytes
+static void graph_render_glyph(uint8_t *bp0, uint8_t *bp1, uint8_t c, char fg,
+        char bg, char flags) {
     uint8_t *src = charMap_ascii[c];
-    uint8_t *dst;
-    int x_byte = x / 8;
-    uint8_t *dst0 = framebuf_bp0 + y * SCR_STRIDE + x_byte;
-    uint8_t *dst1 = framebuf_bp1 + y * SCR_STRIDE + x_byte;
-    char fg, bg;
-    if (flags & FLAG_INVERT) {
-        fg = cl_bg;
-        bg = cl_fg;
-    }
-    else {
-        fg = cl_fg;
-        bg = cl_bg;
-    }
-        
+
     uint8_t bg_bp0_mask_odd  = bp0_masks_odd[bg];
     uint8_t bg_bp0_mask_even = bp0_masks_even[bg];
     uint8_t bg_bp1_mask_odd  = bp1_masks_odd[bg];
@@ -225,31 +308,127 @@ void graph_put_char(int x, int y, char c, char cl_fg, char cl_bg, char flags) {
     uint8_t fg_bp1_mask_odd  = bp1_masks_odd[fg];
     uint8_t fg_bp1_mask_even = bp1_masks_even[fg];
 
-    *dst0 = bg_bp0_mask_even;
-    *dst1 = bg_bp1_mask_even;
-    dst0 += SCR_STRIDE; dst1 += SCR_STRIDE;
-    *dst0 = bg_bp0_mask_odd;
-    *dst1 = bg_bp1_mask_odd;
-    dst0 += SCR_STRIDE; dst1 += SCR_STRIDE;
+    *bp0++ = bg_bp0_mask_even;
+    *bp1++ = bg_bp1_mask_even;
+    *bp0++ = bg_bp0_mask_odd;
+    *bp1++ = bg_bp1_mask_odd;
 
     for (int i = 0; i < 6; i++) {
         uint8_t p = *src++;
         p = graph_text_processing(p, i * 2 + 2, flags);
-        *dst0 = (p & fg_bp0_mask_even) | (~p & bg_bp0_mask_even);
-        *dst1 = (p & fg_bp1_mask_even) | (~p & bg_bp1_mask_even);
-        dst0 += SCR_STRIDE; dst1 += SCR_STRIDE;
+        *bp0++ = (p & fg_bp0_mask_even) | (~p & bg_bp0_mask_even);
+        *bp1++ = (p & fg_bp1_mask_even) | (~p & bg_bp1_mask_even);
         p = *src++;
         p = graph_text_processing(p, i * 2 + 3, flags);
-        *dst0 = (p & fg_bp0_mask_odd) | (~p & bg_bp0_mask_odd);
-        *dst1 = (p & fg_bp1_mask_odd) | (~p & bg_bp1_mask_odd);
-        dst0 += SCR_STRIDE; dst1 += SCR_STRIDE;
+        *bp0++ = (p & fg_bp0_mask_odd) | (~p & bg_bp0_mask_odd);
+        *bp1++ = (p & fg_bp1_mask_odd) | (~p & bg_bp1_mask_odd);
     }
 
-    *dst0 = (flags & FLAG_UNDERLINE) ? fg_bp0_mask_even : bg_bp0_mask_even;
-    *dst1 = (flags & FLAG_UNDERLINE) ? fg_bp0_mask_even : bg_bp1_mask_even;
-    dst0 += SCR_STRIDE; dst1 += SCR_STRIDE;
-    *dst0 = bg_bp0_mask_odd;
-    *dst1 = bg_bp1_mask_odd;
+    *bp0++ = (flags & FLAG_UNDERLINE) ? fg_bp0_mask_even : bg_bp0_mask_even;
+    *bp1++ = (flags & FLAG_UNDERLINE) ? fg_bp1_mask_even : bg_bp1_mask_even;
+    *bp0 = bg_bp0_mask_odd;
+    *bp1 = bg_bp1_mask_odd;
+}
+
+static GLYPH_CACHE_ENTRY *graph_lookup_glyph(uint8_t c, char fg, char bg,
+        char flags) {
+    // Bit 31 marks the key valid, so cleared entries never match
+    uint32_t key = 0x80000000ul | c | ((uint32_t)(uint8_t)flags << 8) |
+            ((uint32_t)(fg & 0xf) << 16) | ((uint32_t)(bg & 0xf) << 20);
+    GLYPH_CACHE_ENTRY *set = glyph_cache[(uint32_t)(key * 2654435761u) >>
+            (32 - GLYPH_CACHE_SET_BITS)];
+    GLYPH_CACHE_ENTRY *victim = &set[0];
+
+    glyph_cache_tick++;
+    for (int i = 0; i < GLYPH_CACHE_WAYS; i++) {
+        if (set[i].key == key) {
+            set[i].last_used = glyph_cache_tick;
+            return &set[i];
+        }
+        if (set[i].last_used < victim->last_used)
+            victim = &set[i];
+    }
+
+    graph_render_glyph(victim->bp0, victim->bp1, c, fg, bg, flags);
+    victim->key = key;
+    victim->last_used = glyph_cache_tick;
+    return victim;
+}
+
+void graph_put_char(int x, int y, char c, char cl_fg, char cl_bg, char flags) {
+    graph_dma_wait();
+    int x_byte = x / 8;
+    uint8_t *dst0 = framebuf_bp0 + y * SCR_STRIDE + x_byte;
+    uint8_t *dst1 = framebuf_bp1 + y * SCR_STRIDE + x_byte;
+    char fg, bg;
+    if (flags & FLAG_INVERT) {
+        fg = cl_bg;
+        bg = cl_fg;
+    }
+    else {
+        fg = cl_fg;
+        bg = cl_bg;
+    }
+    flags &= GLYPH_RENDER_FLAGS;
+
+    GLYPH_CACHE_ENTRY *glyph = graph_lookup_glyph(c, fg, bg, flags);
+    for (int i = 0; i < 16; i++) {
+        dst0[i * SCR_STRIDE] = glyph->bp0[i];
+        dst1[i * SCR_STRIDE] = glyph->bp1[i];
+    }
+}
+
+// Draw n cells of the same attribute starting at x, 4 cells per word store
+// where the destination is word aligned
+void graph_put_text_run(int x, int y, const char *glyphs, int n, char cl_fg,
+        char cl_bg, char flags) {
+    graph_dma_wait();
+    uint8_t *dst0 = framebuf_bp0 + y * SCR_STRIDE + x / 8;
+    uint8_t *dst1 = framebuf_bp1 + y * SCR_STRIDE + x / 8;
+    char fg, bg;
+    if (flags & FLAG_INVERT) {
+        fg = cl_bg;
+        bg = cl_fg;
+    }
+    else {
+        fg = cl_fg;
+        bg = cl_bg;
+    }
+    flags &= GLYPH_RENDER_FLAGS;
+
+    while (n > 0) {
+        if ((((uintptr_t)dst0 & 3) == 0) && (n >= 4)) {
+            GLYPH_CACHE_ENTRY *g0 = graph_lookup_glyph(glyphs[0], fg, bg, flags);
+            GLYPH_CACHE_ENTRY *g1 = graph_lookup_glyph(glyphs[1], fg, bg, flags);
+            GLYPH_CACHE_ENTRY *g2 = graph_lookup_glyph(glyphs[2], fg, bg, flags);
+            GLYPH_CACHE_ENTRY *g3 = graph_lookup_glyph(glyphs[3], fg, bg, flags);
+            uint32_t *wdst0 = (uint32_t *)dst0;
+            uint32_t *wdst1 = (uint32_t *)dst1;
+            for (int i = 0; i < 16; i++) {
+                // Little endian, the leftmost cell goes to the lowest byte
+                *wdst0 = g0->bp0[i] | (g1->bp0[i] << 8) |
+                        (g2->bp0[i] << 16) | ((uint32_t)g3->bp0[i] << 24);
+                *wdst1 = g0->bp1[i] | (g1->bp1[i] << 8) |
+                        (g2->bp1[i] << 16) | ((uint32_t)g3->bp1[i] << 24);
+                wdst0 += SCR_STRIDE / 4;
+                wdst1 += SCR_STRIDE / 4;
+            }
+            glyphs += 4;
+            dst0 += 4;
+            dst1 += 4;
+            n -= 4;
+        }
+        else {
+            GLYPH_CACHE_ENTRY *glyph = graph_lookup_glyph(*glyphs++, fg, bg, flags);
+            for (int i = 0; i < 16; i++) {
+                dst0[i * SCR_STRIDE] = glyph->bp0[i];
+                dst1[i * SCR_STRIDE] = glyph->bp1[i];
+            }
+            dst0++;
+            dst1++;
+            n--;
+        }
+    }
 }
 
 void graph_put_char_small(int x, int y, char c, char cl_fg, char cl_bg) {
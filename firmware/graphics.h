@@ -31,5 +31,8 @@
 
 void graph_put_pixel(int x, int y, int c);
 void graph_fill_rect(int x1, int y1, int x2, int y2, int c);
+void graph_copy_lines(int dst_y, int src_y, int h);
 void graph_put_char(int x, int y, char c, char cl_fg, char cl_bg, char flags);
+void graph_put_text_run(int x, int y, const char *glyphs, int n, char cl_fg,
+        char cl_bg, char flags);
 void graph_put_char_small(int x, int y, char c, char cl_fg, char cl_bg);
\ No newline at end of file
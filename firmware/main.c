@@ -25,13 +25,26 @@
 #include "graphics.h"
 #include "terminal.h"
 #include "serial.h"
+#include "settings.h"
 #include "usbhid.h"
+#include "prof.h"
 
 int main()
 {
     stdio_init_all();
     el_start();
     serial_init();
+    if (settings_load())
+        serial_set_config(&settings.serial);
+    if (settings.autobaud) {
+        uint32_t baud_rate = serial_autobaud(2000);
+        if (baud_rate) {
+            settings.serial.baud_rate = baud_rate;
+            serial_set_config(&settings.serial);
+        }
+    }
+    // After autobaud, which also uses SysTick
+    prof_init();
     usbhid_init();
     term_init();
 
@@ -38,9 +38,8 @@
 #include "../termcore.h"
 #include "../graphics.h"
 #include "../terminal.h"
-
-// serial functions provided for pc port:
-extern void serial_rx_push(uint8_t ch);
+#include "../setup.h"
+#include "session.h"
 
 #define TARGET_FPS (120)
 
@@ -50,8 +49,9 @@ int master_fd = -1;
 int slave_fd = -1;
 
 // Updated by graphics.c, used by main.c
-unsigned char framebuf_bp0[SCR_STRIDE * SCR_BUF_HEIGHT];
-unsigned char framebuf_bp1[SCR_STRIDE * SCR_BUF_HEIGHT];
+// Word aligned for DMA and word stores
+unsigned char framebuf_bp0[SCR_STRIDE * SCR_BUF_HEIGHT] __attribute__((aligned(4)));
+unsigned char framebuf_bp1[SCR_STRIDE * SCR_BUF_HEIGHT] __attribute__((aligned(4)));
 
 // Updated by pcmain.c, used by terminal.c
 volatile bool frame_sync = false;
@@ -59,6 +59,17 @@ volatile bool frame_sync = false;
 // Updated by terminal.c, used by main.c
 volatile int frame_scroll_lines = 0;
 
+size_t serial_write(const uint8_t *buf, size_t len) {
+    if (master_fd < 0)
+        return len;
+    ssize_t rv = write(master_fd, buf, len);
+    if (rv < 0) {
+        perror("Couldn't send data");
+        return 0;
+    }
+    return rv;
+}
+
 void serial_putc(char c) {
     if (master_fd < 0)
         return;
@@ -84,7 +95,7 @@ void init_slave(char * cmd)
     argv[1] = NULL;
 
     setenv("TERM", "ansi", 1);
-    setenv("LANG", "", 1);
+    setenv("LANG", "C.UTF-8", 1);
 
     char buf[10];
     sprintf(buf, "%i", TERM_HEIGHT);
@@ -303,23 +314,74 @@ static uint8_t get_hid_key(SDLKey keysym) {
     else return HID_KEY_NONE;
 }
 
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-r capture] [-p capture [-s speed] [-H]]\n"
+            "  -r  record received data to capture\n"
+            "  -p  replay capture instead of running a shell\n"
+            "  -s  replay speed, 0 for as fast as possible\n"
+            "  -H  replay without a window\n", name);
+}
+
+static uint32_t get_ticks() {
+    return session_now_us() / 1000;
+}
+
 int main(int argc, char * argv[])
 {
-    SDL_Init(SDL_INIT_VIDEO);
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    double replay_speed = 1.0;
+    bool headless = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:p:s:H")) != -1) {
+        if (opt == 'r') {
+            record_path = optarg;
+        }
+        else if (opt == 'p') {
+            replay_path = optarg;
+        }
+        else if (opt == 's') {
+            replay_speed = atof(optarg);
+        }
+        else if (opt == 'H') {
+            headless = true;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((headless || (replay_speed != 1.0)) && !replay_path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (replay_path) {
+        if (!session_replay_open(replay_path, replay_speed)) return -1;
+    }
+    else {
+        if (!init_master()) return -1;
+    }
+    if (record_path && !session_record_open(record_path)) return -1;
 
-    // Disable key repeat
-    SDL_EnableKeyRepeat(0, 0);
-    SDL_EnableUNICODE(1);
+    if (!headless) {
+        SDL_Init(SDL_INIT_VIDEO);
 
-    SDL_WM_SetCaption("ELterm PC emulator", NULL);
+        // Disable key repeat
+        SDL_EnableKeyRepeat(0, 0);
+        SDL_EnableUNICODE(1);
 
-    screen = SDL_SetVideoMode(SCR_WIDTH, SCR_HEIGHT, 32, false);
-    assert(screen);
+        SDL_WM_SetCaption("ELterm PC emulator", NULL);
 
-    if (!init_master()) return -1;
+        screen = SDL_SetVideoMode(SCR_WIDTH, SCR_HEIGHT, 32, false);
+        assert(screen);
+    }
 
     bool quitting = false;
-    uint32_t last_frame = SDL_GetTicks();
+    uint32_t last_frame = get_ticks();
+    uint64_t replay_start = session_now_us();
+    size_t replay_bytes = 0;
 
     term_init();
 
@@ -327,7 +389,7 @@ int main(int argc, char * argv[])
         bool got_sdl_event = false;
 
         SDL_Event event;
-        while (SDL_PollEvent(&event)) {
+        while (!headless && SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 quitting = true;
                 break;
@@ -348,61 +410,99 @@ int main(int argc, char * argv[])
 
         if (quitting) break;
 
-        fd_set fd_in;
-        FD_ZERO(&fd_in);
-        FD_SET(master_fd, &fd_in);
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 1 * 1000;
-        //printf("%i\n", delay);
-
-        int rv = select(master_fd+1, &fd_in, NULL, NULL, &tv);
-        if (rv == -1) {
-            if (errno == EINTR) {
-                quitting = true;
-                break;
-            }
-            perror("select()");
+        if (setup_is_active()) {
+            // Host data waits while the setup screen is open, the same as
+            // it stays in the RX ring on the device
+            usleep(1000);
         }
-        else if (rv != 0) {
-            static char buf[512];
-            rv = read(master_fd, buf, sizeof(buf));
+        else if (replay_path) {
+            const uint8_t *data;
+            int rv = session_replay_next(&data);
             if (rv > 0) {
-                //tmt_write(vt, buf, rv);
-                for (int i = 0; i < rv; i++) {
-                    char c = buf[i];
-                    #if 0
-                    char d[10] = {0};
-                    d[0] = c;
-                    if (c == '\x1b') strcpy(d, "\\e");
-                    else if (c == '\r') strcpy(d, "\\r");
-                    else if (c == '\n') strcpy(d, "\\n");
-                    else if (c == '\\') strcpy(d, "\\\\");
-                    write(2, d, strlen(d));
-                    #endif
-                    serial_rx_push(c);
+                session_record(data, rv);
+                term_process_buffer(data, rv);
+                replay_bytes += rv;
+            }
+            else if (rv < 0) {
+                if (headless) {
+                    // Let the last of it be drawn
+                    while (term_update_screen() || term_state_dirty);
+                    double secs = (session_now_us() - replay_start) * 1e-6;
+                    printf("Replayed %zu bytes in %.3f s\n", replay_bytes,
+                            secs);
+                    quitting = true;
+                    break;
                 }
+                // Keep showing the screen until the window is closed
+                usleep(1000);
             }
             else {
-                // Child terminated?
-                quitting = true;
+                usleep(1000);
+            }
+        }
+        else {
+            fd_set fd_in;
+            FD_ZERO(&fd_in);
+            FD_SET(master_fd, &fd_in);
+            struct timeval tv;
+            tv.tv_sec = 0;
+            tv.tv_usec = 1 * 1000;
+            //printf("%i\n", delay);
+
+            int rv = select(master_fd+1, &fd_in, NULL, NULL, &tv);
+            if (rv == -1) {
+                if (errno == EINTR) {
+                    quitting = true;
+                    break;
+                }
+                perror("select()");
+            }
+            else if (rv != 0) {
+                static char buf[512];
+                rv = read(master_fd, buf, sizeof(buf));
+                if (rv > 0) {
+                    //tmt_write(vt, buf, rv);
+                    #if 0
+                    for (int i = 0; i < rv; i++) {
+                        char c = buf[i];
+                        char d[10] = {0};
+                        d[0] = c;
+                        if (c == '\x1b') strcpy(d, "\\e");
+                        else if (c == '\r') strcpy(d, "\\r");
+                        else if (c == '\n') strcpy(d, "\\n");
+                        else if (c == '\\') strcpy(d, "\\\\");
+                        write(2, d, strlen(d));
+                    }
+                    #endif
+                    session_record((uint8_t *)buf, rv);
+                    term_process_buffer((uint8_t *)buf, rv);
+                }
+                else {
+                    // Child terminated?
+                    quitting = true;
+                }
             }
         }
 
-        uint32_t now = SDL_GetTicks();
+        uint32_t now = get_ticks();
 
         fake_picolib_tick(now);
 
         term_loop();
 
         if (now - last_frame > (1000 / TARGET_FPS)) {
-            render_screen();
-            SDL_Flip(screen);
+            if (!headless) {
+                render_screen();
+                SDL_Flip(screen);
+            }
             frame_sync = true;
             last_frame = now;
         }
     }
 
-    SDL_Quit();
+    session_record_close();
+    session_replay_close();
+    if (!headless)
+        SDL_Quit();
     return 0;
-}
\ No newline at end of file
+}
@@ -42,6 +42,16 @@ void serial_rx_push(uint8_t ch) {
     }
 }
 
+SERIAL_STATS serial_stats;
+volatile bool serial_tx_stopped = false;
+
+size_t serial_read(uint8_t *buf, size_t maxlen) {
+    size_t len = 0;
+    while ((len < maxlen) && serial_getc((char *)&buf[len]))
+        len++;
+    return len;
+}
+
 bool serial_getc(char *c) {
     if (serial_get_free() > 0) {
         *c = serial_ringbuf[rdptr];
@@ -54,6 +64,36 @@ bool serial_getc(char *c) {
     return false;
 }
 
+const uint32_t serial_baud_rates[SERIAL_BAUD_RATE_COUNT] = {
+    1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800,
+    921600, 1000000, 1500000, 2000000, 3000000
+};
+
+static SERIAL_CONFIG serial_config = {
+    .baud_rate = BAUD_RATE,
+    .data_bits = DATA_BITS,
+    .stop_bits = STOP_BITS,
+    .parity = PARITY,
+    .flow_control = SERIAL_FLOW_CONTROL
+};
+
+void serial_set_flow_control(int mode) {
+    return;
+}
+
+void serial_set_config(const SERIAL_CONFIG *config) {
+    // The pty doesn't care about line settings
+    serial_config = *config;
+}
+
+void serial_get_config(SERIAL_CONFIG *config) {
+    *config = serial_config;
+}
+
+uint32_t serial_autobaud(uint32_t timeout_ms) {
+    return 0;
+}
+
 void serial_init() {
     return;
 }
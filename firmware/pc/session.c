@@ -0,0 +1,156 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "session.h"
+
+static FILE *record_file = NULL;
+static uint64_t record_last_us;
+
+static FILE *replay_file = NULL;
+static double replay_speed;
+static uint64_t replay_start_us;
+// Recorded time of the pending chunk, from the start of the capture
+static uint64_t replay_time_us;
+static uint8_t replay_buf[SESSION_MAX_CHUNK];
+static int replay_len = -1;
+
+uint64_t session_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void session_put_varint(FILE *f, uint64_t value) {
+    while (value >= 0x80) {
+        fputc((value & 0x7f) | 0x80, f);
+        value >>= 7;
+    }
+    fputc(value, f);
+}
+
+static bool session_get_varint(FILE *f, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(f);
+        if (c == EOF)
+            return false;
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool session_record_open(const char *path) {
+    record_file = fopen(path, "wb");
+    if (!record_file) {
+        perror(path);
+        return false;
+    }
+    fwrite(SESSION_MAGIC, 1, 4, record_file);
+    fputc(SESSION_VERSION, record_file);
+    record_last_us = session_now_us();
+    return true;
+}
+
+void session_record(const uint8_t *buf, size_t len) {
+    if (!record_file)
+        return;
+    uint64_t now = session_now_us();
+    session_put_varint(record_file, now - record_last_us);
+    session_put_varint(record_file, len);
+    fwrite(buf, 1, len, record_file);
+    record_last_us = now;
+}
+
+void session_record_close() {
+    if (record_file)
+        fclose(record_file);
+    record_file = NULL;
+}
+
+// Read the header of the next chunk, replay_len is -1 at the end
+static void session_replay_load() {
+    uint64_t delay;
+    uint64_t len;
+    replay_len = -1;
+    if (!session_get_varint(replay_file, &delay) ||
+            !session_get_varint(replay_file, &len))
+        return;
+    if (len > SESSION_MAX_CHUNK) {
+        fprintf(stderr, "Capture chunk of %llu bytes is too long\n",
+                (unsigned long long)len);
+        return;
+    }
+    replay_time_us += delay;
+    replay_len = len;
+}
+
+bool session_replay_open(const char *path, double speed) {
+    char magic[5];
+    replay_file = fopen(path, "rb");
+    if (!replay_file) {
+        perror(path);
+        return false;
+    }
+    if ((fread(magic, 1, 5, replay_file) != 5) ||
+            memcmp(magic, SESSION_MAGIC, 4) ||
+            (magic[4] != SESSION_VERSION)) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        fclose(replay_file);
+        replay_file = NULL;
+        return false;
+    }
+    replay_speed = speed;
+    replay_time_us = 0;
+    replay_start_us = session_now_us();
+    session_replay_load();
+    return true;
+}
+
+int session_replay_next(const uint8_t **data) {
+    if (replay_len < 0)
+        return -1;
+    if (replay_speed > 0) {
+        double elapsed = (session_now_us() - replay_start_us) * replay_speed;
+        if (elapsed < replay_time_us)
+            return 0;
+    }
+    int len = replay_len;
+    if (fread(replay_buf, 1, len, replay_file) != (size_t)len) {
+        fprintf(stderr, "Capture is truncated\n");
+        replay_len = -1;
+        return -1;
+    }
+    session_replay_load();
+    *data = replay_buf;
+    return len;
+}
+
+void session_replay_close() {
+    if (replay_file)
+        fclose(replay_file);
+    replay_file = NULL;
+    replay_len = -1;
+}
@@ -0,0 +1,47 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Recording and replay of the data received from the host. A capture is
+// the magic "ELTS", a version byte, then for each chunk received the delay
+// since the previous one in microseconds and the length, both as LEB128,
+// followed by the data.
+#define SESSION_MAGIC "ELTS"
+#define SESSION_VERSION (1)
+#define SESSION_MAX_CHUNK (65536)
+
+uint64_t session_now_us();
+
+bool session_record_open(const char *path);
+void session_record(const uint8_t *buf, size_t len);
+void session_record_close();
+
+// Replay at speed times the recorded pace, 0 for as fast as possible
+bool session_replay_open(const char *path, double speed);
+// Returns the length of the next chunk once it is due and points data to
+// it, 0 when it is not due yet, -1 at the end of the capture
+int session_replay_next(const uint8_t **data);
+void session_replay_close();
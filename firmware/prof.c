@@ -0,0 +1,84 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#if PICO_ON_DEVICE
+#include "hardware/clocks.h"
+#endif
+#include "prof.h"
+
+PROF_DATA prof_data;
+
+static const char *prof_phase_names[PROF_PHASE_COUNT] = {
+    [PROF_PARSE] = "parse",
+    [PROF_UPDATE] = "update",
+    [PROF_DRAW] = "draw",
+    [PROF_SCROLL] = "scroll"
+};
+
+static const char *prof_counter_names[PROF_COUNTER_COUNT] = {
+    [PROF_BYTES] = "bytes",
+    [PROF_ESC] = "esc",
+    [PROF_CSI] = "csi",
+    [PROF_OSC] = "osc",
+    [PROF_CELLS_DIFFED] = "diffed",
+    [PROF_CELLS_DRAWN] = "drawn",
+    [PROF_DMA_RECONFIG] = "dma",
+    [PROF_RX_DROPPED] = "rxdrop"
+};
+
+void prof_init() {
+#if PICO_ON_DEVICE
+    // Free running, also used by serial_autobaud() with the same setup
+    systick_hw->rvr = 0xffffff;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5; // Enabled, processor clock
+#endif
+}
+
+void prof_reset() {
+    memset(&prof_data, 0, sizeof(prof_data));
+}
+
+uint32_t prof_phase_us(int phase) {
+#if PICO_ON_DEVICE
+    return prof_data.ticks[phase] / (clock_get_hz(clk_sys) / 1000000);
+#else
+    return prof_data.ticks[phase] / 1000;
+#endif
+}
+
+int prof_report(char *buf, size_t size) {
+    int len = 0;
+    for (int i = 0; (i < PROF_PHASE_COUNT) && ((size_t)len < size); i++) {
+        len += snprintf(buf + len, size - len, "%s%s=%luus/%lu",
+                i ? ";" : "", prof_phase_names[i],
+                (unsigned long)prof_phase_us(i),
+                (unsigned long)prof_data.calls[i]);
+    }
+    for (int i = 0; (i < PROF_COUNTER_COUNT) && ((size_t)len < size); i++) {
+        len += snprintf(buf + len, size - len, ";%s=%lu",
+                prof_counter_names[i], (unsigned long)prof_data.counters[i]);
+    }
+    return ((size_t)len < size) ? len : (int)size - 1;
+}
@@ -0,0 +1,89 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#if PICO_ON_DEVICE
+#include "hardware/structs/systick.h"
+#else
+#include <time.h>
+#endif
+
+// Time spent in each phase. Ticks are SysTick cycles on the device, which
+// has one per core, and nanoseconds on the PC. Update includes draw and
+// scroll, which run inside it.
+#define PROF_PARSE (0)
+#define PROF_UPDATE (1)
+#define PROF_DRAW (2)
+#define PROF_SCROLL (3)
+#define PROF_PHASE_COUNT (4)
+
+// Event counters
+#define PROF_BYTES (0)          // Bytes parsed
+#define PROF_ESC (1)            // Escape sequences
+#define PROF_CSI (2)            // Control sequences
+#define PROF_OSC (3)            // Operating system commands
+#define PROF_CELLS_DIFFED (4)   // Cells compared against the front buffer
+#define PROF_CELLS_DRAWN (5)    // Glyphs drawn
+#define PROF_DMA_RECONFIG (6)   // Frames the panel DMA was set up for
+#define PROF_RX_DROPPED (7)     // Received bytes lost to a full ring
+#define PROF_COUNTER_COUNT (8)
+
+typedef struct {
+    uint64_t ticks[PROF_PHASE_COUNT];
+    uint32_t calls[PROF_PHASE_COUNT];
+    uint32_t counters[PROF_COUNTER_COUNT];
+} PROF_DATA;
+
+extern PROF_DATA prof_data;
+
+static inline uint32_t prof_begin() {
+#if PICO_ON_DEVICE
+    return systick_hw->cvr;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+#endif
+}
+
+static inline void prof_end(int phase, uint32_t start) {
+#if PICO_ON_DEVICE
+    // SysTick counts down from 24 bits
+    prof_data.ticks[phase] += (start - systick_hw->cvr) & 0xffffff;
+#else
+    prof_data.ticks[phase] += prof_begin() - start;
+#endif
+    prof_data.calls[phase]++;
+}
+
+static inline void prof_count(int counter, uint32_t n) {
+    prof_data.counters[counter] += n;
+}
+
+// Start the cycle counter of the calling core
+void prof_init();
+void prof_reset();
+uint32_t prof_phase_us(int phase);
+// Print all phases and counters as name=value pairs separated by ';'
+int prof_report(char *buf, size_t size);
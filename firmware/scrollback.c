@@ -0,0 +1,176 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "termcore.h"
+#include "graphics.h"
+#include "scrollback.h"
+
+// A line is stored as a 2 byte header (text length, span count), the
+// attribute spans as (length, flag, color) triples, then the glyphs
+#define LINE_HEADER_SIZE 2
+#define LINE_SPAN_SIZE 3
+#define LINE_MAX_SIZE (LINE_HEADER_SIZE + (LINE_SPAN_SIZE + 1) * TERM_WIDTH)
+
+static uint8_t scrollback_buf[SCROLLBACK_SIZE];
+// Free running byte offset of each line, and of the end of the newest line
+static uint32_t line_start[SCROLLBACK_MAX_LINES];
+// Characters present in each line, lets search skip most lines undecoded
+static uint32_t line_chars[SCROLLBACK_MAX_LINES];
+static uint32_t next_byte = 0;
+// Free running line numbers, first_line is the oldest line kept
+static uint32_t first_line = 0;
+static uint32_t next_line = 0;
+
+// Cells that look the same as a default blank cell
+static bool scrollback_is_blank(TERM_CELL cell) {
+    uint8_t c = CELL_GLYPH(cell);
+    return ((c == ' ') || (c == 0)) &&
+            !(CELL_FLAG(cell) & (FLAG_INVERT | FLAG_UNDERLINE | FLAG_STHROUGH)) &&
+            ((CELL_COLOR(cell) & 0xf) == COLOR_BLACK);
+}
+
+static int scrollback_encode(const TERM_STATE *state, int y, uint8_t *rec,
+        uint32_t *chars_out) {
+    int len = TERM_WIDTH;
+    while ((len > 0) && scrollback_is_blank(term_get_cell(state, y, len - 1)))
+        len--;
+
+    uint8_t *span = rec + LINE_HEADER_SIZE;
+    int spans = 0;
+    TERM_CELL attr = 0;
+    for (int x = 0; x < len; x++) {
+        TERM_CELL cell = term_get_cell(state, y, x);
+        if ((spans == 0) || (CELL_ATTR(cell) != attr)) {
+            attr = CELL_ATTR(cell);
+            span = rec + LINE_HEADER_SIZE + spans * LINE_SPAN_SIZE;
+            span[0] = 0;
+            span[1] = CELL_FLAG(cell);
+            span[2] = CELL_COLOR(cell);
+            spans++;
+        }
+        span[0]++;
+    }
+    rec[0] = len;
+    rec[1] = spans;
+    uint8_t *text = rec + LINE_HEADER_SIZE + spans * LINE_SPAN_SIZE;
+    uint32_t chars = 0;
+    for (int x = 0; x < len; x++) {
+        text[x] = CELL_GLYPH(term_get_cell(state, y, x));
+        chars |= SCROLLBACK_CHAR_BIT(text[x]);
+    }
+    *chars_out = chars;
+    return LINE_HEADER_SIZE + spans * LINE_SPAN_SIZE + len;
+}
+
+// Copy to and from the ring, pos is free running
+static void scrollback_write(uint32_t pos, const uint8_t *src, int len) {
+    uint32_t offset = pos % SCROLLBACK_SIZE;
+    int span = SCROLLBACK_SIZE - offset;
+    if (span > len)
+        span = len;
+    memcpy(&scrollback_buf[offset], src, span);
+    memcpy(scrollback_buf, src + span, len - span);
+}
+
+static void scrollback_read(uint32_t pos, uint8_t *dst, int len) {
+    uint32_t offset = pos % SCROLLBACK_SIZE;
+    int span = SCROLLBACK_SIZE - offset;
+    if (span > len)
+        span = len;
+    memcpy(dst, &scrollback_buf[offset], span);
+    memcpy(dst + span, scrollback_buf, len - span);
+}
+
+void scrollback_clear() {
+    first_line = next_line;
+}
+
+void scrollback_push(const TERM_STATE *state, int y) {
+    uint8_t rec[LINE_MAX_SIZE];
+    uint32_t chars;
+    int len = scrollback_encode(state, y, rec, &chars);
+    // Drop the oldest lines until the new one fits
+    while ((next_line - first_line == SCROLLBACK_MAX_LINES) ||
+            ((first_line != next_line) && (next_byte -
+            line_start[first_line % SCROLLBACK_MAX_LINES] + len >
+            SCROLLBACK_SIZE))) {
+        first_line++;
+    }
+    scrollback_write(next_byte, rec, len);
+    line_start[next_line % SCROLLBACK_MAX_LINES] = next_byte;
+    line_chars[next_line % SCROLLBACK_MAX_LINES] = chars;
+    next_line++;
+    next_byte += len;
+}
+
+int scrollback_lines() {
+    return next_line - first_line;
+}
+
+void scrollback_get_line(int n, TERM_STATE *state, int y) {
+    TERM_CELL blank = MAKE_CELL(' ', 0, DEFAULT_COLOR);
+    if ((n < 0) || (n >= scrollback_lines())) {
+        term_fill_cells(state, y, 0, TERM_WIDTH, blank);
+        return;
+    }
+    uint32_t pos = line_start[(next_line - 1 - n) % SCROLLBACK_MAX_LINES];
+    uint8_t rec[LINE_MAX_SIZE];
+    scrollback_read(pos, rec, LINE_HEADER_SIZE);
+    int len = rec[0];
+    int spans = rec[1];
+    scrollback_read(pos + LINE_HEADER_SIZE, rec + LINE_HEADER_SIZE,
+            spans * LINE_SPAN_SIZE + len);
+
+    uint8_t *span = rec + LINE_HEADER_SIZE;
+    uint8_t *text = span + spans * LINE_SPAN_SIZE;
+    int x = 0;
+    for (int i = 0; i < spans; i++, span += LINE_SPAN_SIZE) {
+        for (int j = 0; j < span[0]; j++, x++) {
+            term_set_cell(state, y, x, MAKE_CELL(text[x], span[1], span[2]));
+        }
+    }
+    term_fill_cells(state, y, len, TERM_WIDTH - len, blank);
+}
+
+uint32_t scrollback_first() {
+    return first_line;
+}
+
+uint32_t scrollback_next() {
+    return next_line;
+}
+
+uint32_t scrollback_line_chars(uint32_t line) {
+    return line_chars[line % SCROLLBACK_MAX_LINES];
+}
+
+int scrollback_get_text(uint32_t line, uint8_t *text) {
+    uint32_t pos = line_start[line % SCROLLBACK_MAX_LINES];
+    uint8_t header[LINE_HEADER_SIZE];
+    scrollback_read(pos, header, LINE_HEADER_SIZE);
+    int len = header[0];
+    scrollback_read(pos + LINE_HEADER_SIZE + header[1] * LINE_SPAN_SIZE,
+            text, len);
+    return len;
+}
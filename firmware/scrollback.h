@@ -0,0 +1,49 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+#include "termcore.h"
+
+// History of rows scrolled off the top of the main screen. Lines are
+// stored with trailing blanks trimmed and attributes as runs, so a typical
+// line takes a few dozen bytes.
+#define SCROLLBACK_SIZE (32 * 1024)
+#define SCROLLBACK_MAX_LINES (1024)
+
+void scrollback_clear();
+// Save buffer row y of state as the newest line
+void scrollback_push(const TERM_STATE *state, int y);
+int scrollback_lines();
+// Decode line n, counting back from the newest line 0, into buffer row y
+// of state
+void scrollback_get_line(int n, TERM_STATE *state, int y);
+// Lines by free running number, which does not change as new lines are
+// pushed. Valid lines are scrollback_first() up to scrollback_next() - 1.
+uint32_t scrollback_first();
+uint32_t scrollback_next();
+// Bitmap of the characters present in the line, see SCROLLBACK_CHAR_BIT
+uint32_t scrollback_line_chars(uint32_t line);
+// Copy the glyphs of the line into text, returns the length
+int scrollback_get_text(uint32_t line, uint8_t *text);
+
+// Character presence bit, letters of either case share a bit
+#define SCROLLBACK_CHAR_BIT(c) (1ul << ((c) & 0x1f))
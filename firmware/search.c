@@ -0,0 +1,165 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "termcore.h"
+#include "scrollback.h"
+#include "search.h"
+
+static uint8_t search_pattern[SEARCH_MAX_LEN];
+static int search_len;
+// Horspool shift for each folded character
+static uint8_t search_shift[256];
+// Characters a line must contain to be worth scanning
+static uint32_t search_chars;
+static int search_state = SEARCH_IDLE;
+// Last line scanned: screen rows from the bottom up, then history lines
+// from the newest back
+static bool search_in_history;
+static uint32_t search_line;
+// Column to carry on from in the last line scanned, -1 to move to the line
+// above first
+static int search_from;
+static SEARCH_HIT search_result;
+
+static inline uint8_t search_fold(uint8_t c) {
+    return ((c >= 'A') && (c <= 'Z')) ? (c + 'a' - 'A') : c;
+}
+
+// Horspool over one line of text from column pos, returns the column of the
+// first match
+static int search_match(const uint8_t *text, int len, int pos) {
+    int last = search_len - 1;
+    while (pos + last < len) {
+        int i = last;
+        while (search_fold(text[pos + i]) == search_pattern[i]) {
+            if (i == 0)
+                return pos;
+            i--;
+        }
+        pos += search_shift[search_fold(text[pos + last])];
+    }
+    return -1;
+}
+
+static void search_rewind() {
+    search_in_history = false;
+    search_line = TERM_HEIGHT;
+    search_from = -1;
+    search_state = (search_len > 0) ? SEARCH_RUNNING : SEARCH_IDLE;
+}
+
+void search_start(const char *pattern, int len) {
+    if (len > SEARCH_MAX_LEN)
+        len = SEARCH_MAX_LEN;
+    search_len = len;
+    search_chars = 0;
+    for (int i = 0; i < len; i++) {
+        search_pattern[i] = search_fold(pattern[i]);
+        search_chars |= SCROLLBACK_CHAR_BIT(search_pattern[i]);
+    }
+    memset(search_shift, len, sizeof(search_shift));
+    for (int i = 0; i < len - 1; i++)
+        search_shift[search_pattern[i]] = len - 1 - i;
+    search_rewind();
+}
+
+void search_next() {
+    if (search_state == SEARCH_NOT_FOUND) {
+        // Wrap around
+        search_rewind();
+    }
+    else if (search_state == SEARCH_FOUND) {
+        // Later matches on the same line come first, unless the line has
+        // been dropped from the history meanwhile
+        if (!search_in_history || (search_line >= scrollback_first()))
+            search_from = search_result.x + 1;
+        search_state = SEARCH_RUNNING;
+    }
+}
+
+void search_stop() {
+    search_state = SEARCH_IDLE;
+}
+
+// Move to the line above, returns false past the oldest history line. Lines
+// dropped from the history while searching end the search too.
+static bool search_advance() {
+    if (!search_in_history) {
+        if (search_line > 0) {
+            search_line--;
+            return true;
+        }
+        search_in_history = true;
+        search_line = scrollback_next();
+    }
+    if (search_line <= scrollback_first())
+        return false;
+    search_line--;
+    return true;
+}
+
+int search_step(const TERM_STATE *state) {
+    uint8_t text[TERM_WIDTH];
+
+    for (int i = 0; (i < SEARCH_STEP_LINES) &&
+            (search_state == SEARCH_RUNNING); i++) {
+        if (search_from < 0) {
+            if (!search_advance()) {
+                search_state = SEARCH_NOT_FOUND;
+                break;
+            }
+            search_from = 0;
+        }
+        int len = 0;
+        if (!search_in_history) {
+            int row = state->rowmap[search_line];
+            for (int x = 0; x < TERM_WIDTH; x++)
+                text[x] = CELL_GLYPH(term_get_cell(state, row, x));
+            len = TERM_WIDTH;
+        }
+        else if ((scrollback_line_chars(search_line) & search_chars) ==
+                search_chars) {
+            len = scrollback_get_text(search_line, text);
+        }
+
+        int x = search_match(text, len, search_from);
+        search_from = -1;
+        if (x >= 0) {
+            search_result.history = search_in_history;
+            search_result.line = search_line;
+            search_result.x = x;
+            search_result.len = search_len;
+            search_state = SEARCH_FOUND;
+        }
+    }
+    return search_state;
+}
+
+int search_status() {
+    return search_state;
+}
+
+const SEARCH_HIT *search_hit() {
+    return &search_result;
+}
@@ -0,0 +1,54 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+#include "termcore.h"
+
+// Incremental, case insensitive search of the screen and the scrollback
+// history, from the bottom of the screen upwards. The work is split into
+// search_step() calls so received data keeps being processed meanwhile.
+#define SEARCH_MAX_LEN (40)
+// Lines looked at by one search_step() call
+#define SEARCH_STEP_LINES (64)
+
+#define SEARCH_IDLE (0)
+#define SEARCH_RUNNING (1)
+#define SEARCH_FOUND (2)
+#define SEARCH_NOT_FOUND (3)
+
+typedef struct {
+    bool history;
+    // Screen row, or free running scrollback line number
+    uint32_t line;
+    int x;
+    int len;
+} SEARCH_HIT;
+
+// Start over from the bottom of the screen
+void search_start(const char *pattern, int len);
+// Look for the next match above the current one
+void search_next();
+void search_stop();
+// Look at up to SEARCH_STEP_LINES lines of state and history
+int search_step(const TERM_STATE *state);
+int search_status();
+const SEARCH_HIT *search_hit();
@@ -19,78 +19,366 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 //
+#include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/uart.h"
 #include "hardware/irq.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+#include "hardware/clocks.h"
 #include "serial.h"
+#include "prof.h"
 
-uint8_t serial_ringbuf[SERIAL_RIGNBUF_SIZE];
-static volatile int rdptr = 0;
-static volatile int wrptr = 0;
-
-static int serial_get_free() {
-    int diff = wrptr - rdptr;
-    if (diff < 0)
-        diff += SERIAL_RIGNBUF_SIZE;
-    return diff;
-}
-
-void serial_rx_irq() {
-    while (uart_is_readable(UART_ID)) {
-        uint8_t ch = uart_getc(UART_ID);
-        if ((wrptr != (rdptr - 1)) && 
-                (!((wrptr == SERIAL_RIGNBUF_SIZE - 1) && (rdptr == 0)))) {
-            serial_ringbuf[wrptr] = ch;
-            wrptr++;
-            if (wrptr == SERIAL_RIGNBUF_SIZE) wrptr = 0;
+// RX is written by a DMA channel in ring mode, so the buffer has to be
+// aligned to its size
+uint8_t serial_ringbuf[SERIAL_RIGNBUF_SIZE]
+        __attribute__((aligned(SERIAL_RIGNBUF_SIZE)));
+// Transfers per DMA trigger, a multiple of the ring size so that the total
+// byte count stays in step with the ring position
+#define SERIAL_DMA_COUNT (1ul << 30)
+
+static int serial_rx_chan;
+// Bytes received before the current DMA trigger
+static volatile uint32_t serial_rx_base = 0;
+// Free running read count, the ring position is the low bits
+static uint32_t rdptr = 0;
+
+static SERIAL_CONFIG serial_config = {
+    .baud_rate = BAUD_RATE,
+    .data_bits = DATA_BITS,
+    .stop_bits = STOP_BITS,
+    .parity = PARITY,
+    .flow_control = SERIAL_FLOW_CONTROL
+};
+
+static int serial_flow = SERIAL_FLOW_NONE;
+static bool serial_throttled = false;
+static uint64_t serial_throttle_start;
+SERIAL_STATS serial_stats;
+volatile bool serial_tx_stopped = false;
+
+static uint8_t serial_tx_ringbuf[SERIAL_TX_RINGBUF_SIZE];
+// Free running counts, the ring position is the low bits
+static volatile uint32_t serial_tx_rdptr = 0;
+static volatile uint32_t serial_tx_wrptr = 0;
+
+static void serial_tx_kick();
+static void serial_uart_irq();
+
+static void serial_dma_irq() {
+    if (dma_channel_get_irq1_status(serial_rx_chan)) {
+        dma_channel_acknowledge_irq1(serial_rx_chan);
+        // Out of transfers, keep going around the ring
+        serial_rx_base += SERIAL_DMA_COUNT;
+        dma_channel_set_trans_count(serial_rx_chan, SERIAL_DMA_COUNT, true);
+    }
+}
+
+// Free running count of bytes written by the DMA
+static uint32_t serial_get_wrptr() {
+    uint32_t irq_status = save_and_disable_interrupts();
+    uint32_t wrptr = serial_rx_base + SERIAL_DMA_COUNT -
+            dma_channel_hw_addr(serial_rx_chan)->transfer_count;
+    restore_interrupts(irq_status);
+    return wrptr;
+}
+
+static uint32_t serial_get_used() {
+    uint32_t used = serial_get_wrptr() - rdptr;
+    if (used > SERIAL_RIGNBUF_SIZE) {
+        // The DMA went around and overwrote unread data, drop all of it
+        serial_stats.rx_overruns++;
+        prof_count(PROF_RX_DROPPED, used);
+        rdptr += used;
+        used = 0;
+    }
+    return used;
+}
+
+// Throttle or release the host based on how full the RX ring is. Called
+// from the timer and after every read.
+static void serial_flow_check() {
+    if (serial_flow == SERIAL_FLOW_NONE)
+        return;
+    uint32_t irq_status = save_and_disable_interrupts();
+    uint32_t used = serial_get_wrptr() - rdptr;
+    bool throttle;
+    if (!serial_throttled && (used >= SERIAL_HIGH_WATERMARK))
+        throttle = true;
+    else if (serial_throttled && (used <= SERIAL_LOW_WATERMARK))
+        throttle = false;
+    else
+        throttle = serial_throttled;
+    // Try again on the next check if XON/XOFF can't be sent now
+    if ((throttle != serial_throttled) &&
+            (!(serial_flow & SERIAL_FLOW_SW) || uart_is_writable(UART_ID))) {
+        if (serial_flow & SERIAL_FLOW_SW)
+            uart_get_hw(UART_ID)->dr = throttle ? SERIAL_XOFF : SERIAL_XON;
+        if (serial_flow & SERIAL_FLOW_HW)
+            gpio_put(UART_RTS_PIN, throttle); // RTS is active low
+        if (throttle) {
+            serial_stats.throttle_count++;
+            serial_throttle_start = time_us_64();
+        }
+        else {
+            serial_stats.throttle_us += time_us_64() - serial_throttle_start;
+        }
+        serial_throttled = throttle;
+    }
+    restore_interrupts(irq_status);
+}
+
+static bool serial_flow_timer(struct repeating_timer *t) {
+    serial_flow_check();
+    return true;
+}
+
+// Take XON/XOFF sent by the host out of the received data
+static size_t serial_filter_xonxoff(uint8_t *buf, size_t len) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == SERIAL_XOFF) {
+            serial_tx_stopped = true;
+        }
+        else if (buf[i] == SERIAL_XON) {
+            serial_tx_stopped = false;
+            serial_tx_kick();
         }
+        else
+            buf[out++] = buf[i];
     }
+    return out;
+}
+
+size_t serial_read(uint8_t *buf, size_t maxlen) {
+    size_t len = serial_get_used();
+    if (len > maxlen)
+        len = maxlen;
+    size_t pos = rdptr & (SERIAL_RIGNBUF_SIZE - 1);
+    size_t span = SERIAL_RIGNBUF_SIZE - pos;
+    if (span > len)
+        span = len;
+    memcpy(buf, &serial_ringbuf[pos], span);
+    memcpy(buf + span, serial_ringbuf, len - span);
+    rdptr += len;
+    serial_flow_check();
+    if (serial_flow & SERIAL_FLOW_SW)
+        len = serial_filter_xonxoff(buf, len);
+    return len;
 }
 
 bool serial_getc(char *c) {
-    if (serial_get_free() > 0) {
-        *c = serial_ringbuf[rdptr];
-        int new_rdptr = rdptr + 1;
-        if (new_rdptr == SERIAL_RIGNBUF_SIZE)
-            new_rdptr = 0;
-        rdptr = new_rdptr;
-        return true;
+    return serial_read((uint8_t *)c, 1) == 1;
+}
+
+void serial_set_flow_control(int mode) {
+    uint32_t irq_status = save_and_disable_interrupts();
+    if (serial_throttled) {
+        // Release the host from the old mode first
+        if (serial_flow & SERIAL_FLOW_SW)
+            uart_putc_raw(UART_ID, SERIAL_XON);
+        serial_stats.throttle_us += time_us_64() - serial_throttle_start;
+        serial_throttled = false;
+    }
+    serial_tx_stopped = false;
+    serial_flow = mode;
+    restore_interrupts(irq_status);
+    serial_tx_kick();
+
+    if (mode & SERIAL_FLOW_HW) {
+        // RTS is driven by the ring watermarks rather than the UART FIFO
+        gpio_init(UART_RTS_PIN);
+        gpio_set_dir(UART_RTS_PIN, GPIO_OUT);
+        gpio_put(UART_RTS_PIN, 0);
+        gpio_set_function(UART_CTS_PIN, GPIO_FUNC_UART);
+        uart_set_hw_flow(UART_ID, true, false);
     }
     else {
-        if (uart_is_readable(UART_ID)) {
-            *c = uart_getc(UART_ID);
-            return true;
-        }
+        uart_set_hw_flow(UART_ID, false, false);
+        gpio_deinit(UART_RTS_PIN);
+        gpio_deinit(UART_CTS_PIN);
+    }
+}
+
+void serial_set_config(const SERIAL_CONFIG *config) {
+    static const uart_parity_t parity[] = {
+        [SERIAL_PARITY_NONE] = UART_PARITY_NONE,
+        [SERIAL_PARITY_EVEN] = UART_PARITY_EVEN,
+        [SERIAL_PARITY_ODD] = UART_PARITY_ODD
+    };
+    serial_config = *config;
+    // Let what's queued go out at the old rate
+    while ((serial_tx_rdptr != serial_tx_wrptr) && !serial_tx_stopped)
+        tight_loop_contents();
+    uart_tx_wait_blocking(UART_ID);
+    uart_set_baudrate(UART_ID, config->baud_rate);
+    uart_set_format(UART_ID, config->data_bits, config->stop_bits,
+            parity[config->parity]);
+    serial_set_flow_control(config->flow_control);
+}
+
+void serial_get_config(SERIAL_CONFIG *config) {
+    *config = serial_config;
+}
+
+const uint32_t serial_baud_rates[SERIAL_BAUD_RATE_COUNT] = {
+    1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800,
+    921600, 1000000, 1500000, 2000000, 3000000
+};
+
+// Wait for the RX pin to read level, false on timeout
+static inline bool serial_wait_rx_level(bool level, uint32_t deadline) {
+    while (gpio_get(UART_RX_PIN) != level) {
+        if ((int32_t)(deadline - time_us_32()) <= 0)
+            return false;
+    }
+    return true;
+}
+
+uint32_t serial_autobaud(uint32_t timeout_ms) {
+    // The shortest low pulse on RX is one bit time. Sample the pin directly
+    // and time the pulses with SysTick, which runs at the system clock.
+    gpio_set_function(UART_RX_PIN, GPIO_FUNC_SIO);
+    gpio_set_dir(UART_RX_PIN, GPIO_IN);
+    systick_hw->rvr = 0xffffff;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5; // Enabled, processor clock
+
+    uint32_t min_ticks = 0xffffff;
+    int pulses = 0;
+    uint32_t deadline = time_us_32() + timeout_ms * 1000;
+    while (pulses < 32) {
+        // Time from a falling edge only, so that pulses are timed whole
+        if (!serial_wait_rx_level(1, deadline) ||
+                !serial_wait_rx_level(0, deadline))
+            break;
+        uint32_t start = systick_hw->cvr;
+        if (!serial_wait_rx_level(1, deadline))
+            break;
+        // SysTick counts down
+        uint32_t ticks = (start - systick_hw->cvr) & 0xffffff;
+        if (ticks < min_ticks)
+            min_ticks = ticks;
+        pulses++;
+    }
+    // SysTick is left running for prof.c
+    gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
+
+    if ((pulses == 0) || (min_ticks == 0))
+        return 0;
+    uint32_t measured = clock_get_hz(clk_sys) / min_ticks;
+    uint32_t best = serial_baud_rates[0];
+    for (int i = 0; i < SERIAL_BAUD_RATE_COUNT; i++) {
+        uint32_t rate = serial_baud_rates[i];
+        uint32_t diff = (rate > measured) ? rate - measured : measured - rate;
+        uint32_t best_diff = (best > measured) ? best - measured : measured - best;
+        if (diff < best_diff)
+            best = rate;
     }
-    return false;
+    return best;
 }
 
 void serial_init() {
-    uart_init(UART_ID, 2400);
+    uart_init(UART_ID, serial_config.baud_rate);
     gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
 
-    int actual = uart_set_baudrate(UART_ID, BAUD_RATE);
+    serial_rx_chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(serial_rx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, SERIAL_RINGBUF_BITS);
+    channel_config_set_dreq(&c, uart_get_dreq(UART_ID, false));
 
-    uart_set_hw_flow(UART_ID, false, false);
-    uart_set_format(UART_ID, DATA_BITS, STOP_BITS, PARITY);
-    //uart_set_fifo_enabled(UART_ID, false);
+    dma_channel_set_irq1_enabled(serial_rx_chan, true);
+    irq_add_shared_handler(DMA_IRQ_1, serial_dma_irq,
+            PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
 
-    int UART_IRQ = UART_ID == uart0 ? UART0_IRQ : UART1_IRQ;
+    dma_channel_configure(serial_rx_chan, &c, serial_ringbuf,
+            &uart_get_hw(UART_ID)->dr, SERIAL_DMA_COUNT, true);
 
-    irq_set_exclusive_handler(UART_IRQ, serial_rx_irq);
+    int UART_IRQ = UART_ID == uart0 ? UART0_IRQ : UART1_IRQ;
+    irq_set_exclusive_handler(UART_IRQ, serial_uart_irq);
     irq_set_enabled(UART_IRQ, true);
 
-    uart_set_irq_enables(UART_ID, true, false);
+    serial_set_config(&serial_config);
+    // The ring fills without the CPU, so watch it between reads
+    static repeating_timer_t timer;
+    add_repeating_timer_ms(-1, serial_flow_timer, NULL, &timer);
+}
+
+// Move queued bytes into the TX FIFO, keep the TX interrupt on while
+// there is more to send
+static void serial_tx_fill() {
+    while ((serial_tx_rdptr != serial_tx_wrptr) && !serial_tx_stopped &&
+            uart_is_writable(UART_ID)) {
+        uart_get_hw(UART_ID)->dr =
+                serial_tx_ringbuf[serial_tx_rdptr & (SERIAL_TX_RINGBUF_SIZE - 1)];
+        serial_tx_rdptr++;
+    }
+    bool more = (serial_tx_rdptr != serial_tx_wrptr) && !serial_tx_stopped;
+    uart_set_irq_enables(UART_ID, false, more);
+}
+
+static void serial_uart_irq() {
+    serial_tx_fill();
+}
+
+// Restart sending after new data is queued or the host sent XON. The TX
+// interrupt only fires when the FIFO drains past its level, so the FIFO has
+// to be primed here.
+static void serial_tx_kick() {
+    uint32_t irq_status = save_and_disable_interrupts();
+    serial_tx_fill();
+    restore_interrupts(irq_status);
+}
+
+size_t serial_write(const uint8_t *buf, size_t len) {
+    uint32_t room = SERIAL_TX_RINGBUF_SIZE - (serial_tx_wrptr - serial_tx_rdptr);
+    if (len > room) {
+        serial_stats.tx_full++;
+        len = room;
+    }
+    for (size_t i = 0; i < len; i++) {
+        serial_tx_ringbuf[(serial_tx_wrptr + i) & (SERIAL_TX_RINGBUF_SIZE - 1)] =
+                buf[i];
+    }
+    serial_tx_wrptr += len;
+    serial_tx_kick();
+    return len;
+}
+
+// Queue all of len bytes, only waiting when the ring is full
+static void serial_write_all(const uint8_t *buf, size_t len) {
+    bool stalled = false;
+    while (len) {
+        size_t written = serial_write(buf, len);
+        buf += written;
+        len -= written;
+        if (len == 0)
+            break;
+        if (serial_tx_stopped) {
+            // The host asked us to stop and the ring is full, XON can only
+            // be seen by the main loop, so don't wait for it
+            serial_stats.tx_dropped += len;
+            break;
+        }
+        if (!stalled) {
+            serial_stats.tx_stalls++;
+            stalled = true;
+        }
+        tight_loop_contents();
+    }
 }
 
 void serial_putc(char c) {
-    uart_putc_raw(UART_ID, c);
+    serial_write_all((uint8_t *)&c, 1);
 }
 
 void serial_puts(char *s) {
     // Unlike uart_puts, this does not do any CR/LF conversion
-    while (*s) {
-        uart_putc_raw(UART_ID, *s++);
-    }
-}
\ No newline at end of file
+    serial_write_all((uint8_t *)s, strlen(s));
+}
@@ -22,24 +22,84 @@
 #pragma once
 
 
+// Defaults, used until settings are loaded
 #define BAUD_RATE 115200
 #define DATA_BITS 8
 #define STOP_BITS 1
-#define PARITY    UART_PARITY_NONE
+#define PARITY    SERIAL_PARITY_NONE
+
+#define SERIAL_PARITY_NONE (0)
+#define SERIAL_PARITY_EVEN (1)
+#define SERIAL_PARITY_ODD  (2)
+
+// Flow control modes, can be or'ed together
+#define SERIAL_FLOW_NONE (0)
+#define SERIAL_FLOW_HW   (1) // RTS/CTS
+#define SERIAL_FLOW_SW   (2) // XON/XOFF
+#define SERIAL_FLOW_CONTROL SERIAL_FLOW_NONE
 
 #if 1
 #define UART_ID uart0
 #define UART_TX_PIN 0
 #define UART_RX_PIN 1
+#define UART_CTS_PIN 2
+#define UART_RTS_PIN 3
 #else
 #define UART_ID uart1
 #define UART_TX_PIN 20
 #define UART_RX_PIN 21
+#define UART_CTS_PIN 22
+#define UART_RTS_PIN 23
 #endif
 
-#define SERIAL_RIGNBUF_SIZE (1024)
+#define SERIAL_RINGBUF_BITS (13)
+#define SERIAL_RIGNBUF_SIZE (1 << SERIAL_RINGBUF_BITS)
+#define SERIAL_TX_RINGBUF_SIZE (1024)
+
+// The host is throttled above the high watermark and released below the
+// low watermark
+#define SERIAL_HIGH_WATERMARK (SERIAL_RIGNBUF_SIZE * 3 / 4)
+#define SERIAL_LOW_WATERMARK (SERIAL_RIGNBUF_SIZE / 4)
+
+#define SERIAL_XON (0x11)
+#define SERIAL_XOFF (0x13)
+
+typedef struct {
+    uint32_t baud_rate;
+    uint8_t data_bits;
+    uint8_t stop_bits;
+    uint8_t parity;
+    uint8_t flow_control;
+} SERIAL_CONFIG;
+
+typedef struct {
+    uint32_t rx_overruns;   // Times received data was dropped, ring full
+    uint32_t throttle_count; // Times the host was told to stop
+    uint64_t throttle_us;   // Total time the host was stopped
+    uint32_t tx_full;       // Writes that didn't fit in the TX ring
+    uint32_t tx_stalls;     // Times serial_puts had to wait for room
+    uint32_t tx_dropped;    // Bytes dropped while stopped with a full ring
+} SERIAL_STATS;
+
+extern SERIAL_STATS serial_stats;
+// Standard rates, for autobaud and the setup screen
+#define SERIAL_BAUD_RATE_COUNT (15)
+extern const uint32_t serial_baud_rates[SERIAL_BAUD_RATE_COUNT];
+// Set when the host sent XOFF, cleared by XON
+extern volatile bool serial_tx_stopped;
 
 void serial_init();
+// Read up to maxlen received bytes, returns the number of bytes read
+size_t serial_read(uint8_t *buf, size_t maxlen);
 bool serial_getc(char *c);
+// Queue up to len bytes for sending without waiting, returns the number of
+// bytes queued
+size_t serial_write(const uint8_t *buf, size_t len);
+void serial_set_flow_control(int mode);
+void serial_set_config(const SERIAL_CONFIG *config);
+void serial_get_config(SERIAL_CONFIG *config);
+// Measure the baud rate from the bit width of incoming data, returns the
+// closest standard rate or 0 if nothing was received in time
+uint32_t serial_autobaud(uint32_t timeout_ms);
 void serial_putc(char c);
 void serial_puts(char *s);
@@ -0,0 +1,90 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stddef.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#ifdef TERM_DUAL_CORE
+#include "pico/multicore.h"
+#endif
+#include "settings.h"
+
+// Settings live in the last flash sector
+#define SETTINGS_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+_Static_assert(sizeof(SETTINGS) <= FLASH_PAGE_SIZE, "settings fit in a page");
+
+SETTINGS settings;
+
+static uint32_t settings_checksum(const SETTINGS *s) {
+    const uint8_t *p = (const uint8_t *)s;
+    uint32_t sum = 0;
+    for (int i = 0; i < offsetof(SETTINGS, checksum); i++) {
+        sum = (sum << 1 | sum >> 31) ^ p[i];
+    }
+    return sum;
+}
+
+static void settings_default() {
+    memset(&settings, 0, sizeof(settings));
+    settings.magic = SETTINGS_MAGIC;
+    settings.version = SETTINGS_VERSION;
+    serial_get_config(&settings.serial);
+    settings.autobaud = false;
+}
+
+bool settings_load() {
+    const SETTINGS *stored = (const SETTINGS *)(XIP_BASE + SETTINGS_OFFSET);
+    if ((stored->magic != SETTINGS_MAGIC) ||
+            (stored->version != SETTINGS_VERSION) ||
+            (stored->checksum != settings_checksum(stored))) {
+        settings_default();
+        return false;
+    }
+    settings = *stored;
+    return true;
+}
+
+bool settings_save() {
+    static uint8_t page[FLASH_PAGE_SIZE];
+    settings.magic = SETTINGS_MAGIC;
+    settings.version = SETTINGS_VERSION;
+    settings.checksum = settings_checksum(&settings);
+    memset(page, 0xff, sizeof(page));
+    memcpy(page, &settings, sizeof(settings));
+
+    // Nothing may run from flash while it's being written
+#ifdef TERM_DUAL_CORE
+    multicore_lockout_start_blocking();
+#endif
+    uint32_t irq_status = save_and_disable_interrupts();
+    flash_range_erase(SETTINGS_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(SETTINGS_OFFSET, page, FLASH_PAGE_SIZE);
+    restore_interrupts(irq_status);
+#ifdef TERM_DUAL_CORE
+    multicore_lockout_end_blocking();
+#endif
+
+    return memcmp((const void *)(XIP_BASE + SETTINGS_OFFSET), &settings,
+            sizeof(settings)) == 0;
+}
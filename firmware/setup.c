@@ -0,0 +1,229 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "graphics.h"
+#include "termcore.h"
+#include "serial.h"
+#include "settings.h"
+#include "setup.h"
+
+enum {
+    ITEM_BAUD_RATE,
+    ITEM_DATA_BITS,
+    ITEM_PARITY,
+    ITEM_STOP_BITS,
+    ITEM_FLOW_CONTROL,
+    ITEM_AUTOBAUD,
+    ITEM_COUNT
+};
+
+static const char *item_names[ITEM_COUNT] = {
+    [ITEM_BAUD_RATE] = "Baud rate",
+    [ITEM_DATA_BITS] = "Data bits",
+    [ITEM_PARITY] = "Parity",
+    [ITEM_STOP_BITS] = "Stop bits",
+    [ITEM_FLOW_CONTROL] = "Flow control",
+    [ITEM_AUTOBAUD] = "Autobaud at power on"
+};
+
+static const char *parity_names[] = {
+    [SERIAL_PARITY_NONE] = "None",
+    [SERIAL_PARITY_EVEN] = "Even",
+    [SERIAL_PARITY_ODD] = "Odd"
+};
+
+static const char *flow_names[] = {
+    [SERIAL_FLOW_NONE] = "None",
+    [SERIAL_FLOW_HW] = "RTS/CTS",
+    [SERIAL_FLOW_SW] = "XON/XOFF",
+    [SERIAL_FLOW_HW | SERIAL_FLOW_SW] = "RTS/CTS and XON/XOFF"
+};
+
+static bool setup_active = false;
+static int setup_item;
+static SETTINGS setup_settings;
+// Settings were confirmed and wait for setup_poll()
+static bool setup_apply_pending = false;
+// The screen being set up for is drawn into its own state, the terminal
+// state is put back when leaving
+static TERM_STATE setup_state;
+static TERM_STATE *setup_saved_state;
+
+static void setup_print(int y, int x, const char *str, char flag) {
+    int row = setup_state.rowmap[y];
+    while (*str && (x < TERM_WIDTH)) {
+        term_set_cell(&setup_state, row, x++, MAKE_CELL(*str++, flag,
+                DEFAULT_COLOR));
+    }
+}
+
+static void setup_draw() {
+    char value[32];
+    for (int y = 0; y < TERM_HEIGHT; y++) {
+        term_fill_cells(&setup_state, setup_state.rowmap[y], 0, TERM_WIDTH,
+                MAKE_CELL(' ', 0, DEFAULT_COLOR));
+    }
+    setup_print(1, 2, "ELTerm Setup", FLAG_BOLD);
+    for (int i = 0; i < ITEM_COUNT; i++) {
+        SERIAL_CONFIG *config = &setup_settings.serial;
+        switch (i) {
+        case ITEM_BAUD_RATE:
+            snprintf(value, sizeof(value), "%lu",
+                    (unsigned long)config->baud_rate);
+            break;
+        case ITEM_DATA_BITS:
+            snprintf(value, sizeof(value), "%d", config->data_bits);
+            break;
+        case ITEM_PARITY:
+            snprintf(value, sizeof(value), "%s", parity_names[config->parity]);
+            break;
+        case ITEM_STOP_BITS:
+            snprintf(value, sizeof(value), "%d", config->stop_bits);
+            break;
+        case ITEM_FLOW_CONTROL:
+            snprintf(value, sizeof(value), "%s",
+                    flow_names[config->flow_control]);
+            break;
+        case ITEM_AUTOBAUD:
+            snprintf(value, sizeof(value), "%s",
+                    setup_settings.autobaud ? "On" : "Off");
+            break;
+        }
+        char flag = (i == setup_item) ? FLAG_INVERT : 0;
+        setup_print(3 + i, 2, (i == setup_item) ? ">" : " ", 0);
+        setup_print(3 + i, 4, item_names[i], flag);
+        setup_print(3 + i, 28, value, flag);
+    }
+    setup_print(4 + ITEM_COUNT, 2,
+            "Up/Down: select  Left/Right: change  Enter: save  Esc: cancel", 0);
+    setup_state.x = 2;
+    setup_state.y = 3 + setup_item;
+    term_invalidate(&setup_state);
+}
+
+static int setup_step(int value, int min, int max, int dir) {
+    value += dir;
+    if (value < min) value = max;
+    if (value > max) value = min;
+    return value;
+}
+
+static void setup_change(int dir) {
+    SERIAL_CONFIG *config = &setup_settings.serial;
+    switch (setup_item) {
+    case ITEM_BAUD_RATE: {
+        int i = 0;
+        while ((i < SERIAL_BAUD_RATE_COUNT - 1) &&
+                (serial_baud_rates[i] < config->baud_rate))
+            i++;
+        i = setup_step(i, 0, SERIAL_BAUD_RATE_COUNT - 1, dir);
+        config->baud_rate = serial_baud_rates[i];
+        break;
+    }
+    case ITEM_DATA_BITS:
+        config->data_bits = setup_step(config->data_bits, 5, 8, dir);
+        break;
+    case ITEM_PARITY:
+        config->parity = setup_step(config->parity, SERIAL_PARITY_NONE,
+                SERIAL_PARITY_ODD, dir);
+        break;
+    case ITEM_STOP_BITS:
+        config->stop_bits = setup_step(config->stop_bits, 1, 2, dir);
+        break;
+    case ITEM_FLOW_CONTROL:
+        config->flow_control = setup_step(config->flow_control,
+                SERIAL_FLOW_NONE, SERIAL_FLOW_HW | SERIAL_FLOW_SW, dir);
+        break;
+    case ITEM_AUTOBAUD:
+        setup_settings.autobaud = !setup_settings.autobaud;
+        break;
+    }
+}
+
+bool setup_is_active() {
+    return setup_active;
+}
+
+void setup_open() {
+    setup_active = true;
+    setup_item = 0;
+    setup_settings = settings;
+    serial_get_config(&setup_settings.serial);
+
+    setup_saved_state = term_state_back;
+    memset(&setup_state, 0, sizeof(setup_state));
+    for (int y = 0; y < TERM_BUF_HEIGHT; y++) {
+        // Keep the buffer slots where they are on the panel
+        int slot = (y + setup_saved_state->y_offset) % TERM_BUF_HEIGHT;
+        setup_state.rowmap[y] = slot;
+    }
+    setup_state.y_offset = setup_saved_state->y_offset;
+    term_state_back = &setup_state;
+    setup_draw();
+}
+
+static void setup_close() {
+    setup_active = false;
+    term_state_back = setup_saved_state;
+    term_invalidate(term_state_back);
+}
+
+void setup_poll() {
+    if (!setup_apply_pending)
+        return;
+    setup_apply_pending = false;
+    serial_set_config(&settings.serial);
+    if (!settings_save())
+        fprintf(stderr, "Failed to save settings\n");
+}
+
+void setup_key(uint8_t keycode) {
+    switch (keycode) {
+    case HID_KEY_ARROW_UP:
+        setup_item = setup_step(setup_item, 0, ITEM_COUNT - 1, -1);
+        break;
+    case HID_KEY_ARROW_DOWN:
+        setup_item = setup_step(setup_item, 0, ITEM_COUNT - 1, 1);
+        break;
+    case HID_KEY_ARROW_LEFT:
+        setup_change(-1);
+        break;
+    case HID_KEY_ARROW_RIGHT:
+        setup_change(1);
+        break;
+    case HID_KEY_ENTER:
+        // Applied later by setup_poll(), outside of the terminal lock
+        settings = setup_settings;
+        setup_apply_pending = true;
+        setup_close();
+        return;
+    case HID_KEY_ESCAPE:
+        setup_close();
+        return;
+    default:
+        return;
+    }
+    setup_draw();
+}
@@ -28,6 +28,9 @@
 #include <stdbool.h>
 #include "termcore.h"
 #include "graphics.h"
+#include "scrollback.h"
+#include "prof.h"
+#include "unicode.h"
 
 // Private Definitions
 typedef enum {
@@ -39,6 +42,9 @@ typedef enum {
     ST_G1S_SEQ,
     ST_OSC_SEQ,
     ST_OSC_PAR,
+    ST_DOCS_SEQ,
+    ST_UTF8_SEQ,
+    ST_COUNT
 } PARSER_STATE;
 
 static TERM_STATE term_state_back_main;
@@ -53,32 +59,267 @@ static int saved_x, saved_y;
 // Saved cursor for alternative buffer
 static int alt_x, alt_y;
 static char saved_color, saved_flag;
+static uint8_t saved_charset_g[2];
+static int saved_charset_gl;
 // Modes
 static bool mode_auto_warp = true;
 bool mode_app_keypad = false;
 bool mode_app_cursor = false;
 bool mode_cursor_blinking = true;
 bool mode_show_cursor = true;
+bool mode_synchronized_update = false;
 static bool mode_insert = false;
 static bool mode_auto_newline = false;
+// Decode bytes above 0x7f as UTF-8 rather than as glyph indices
+static bool mode_utf8 = true;
 char last_graph_char = '\0';
 
 static bool pending_wrap = false;
+// Scrolling region set by DECSTBM, inclusive screen rows
+static int scroll_top = 0;
+static int scroll_bottom = TERM_HEIGHT - 1;
+static PARSER_STATE parser_state = ST_NORMAL;
+// Parser arguments
+static char csi[5];
+static int csi_codes[5];
+static int arg_counter = 0;
+static int chr_counter = 0;
+static int osc_type = 0;
+static bool dec_set = false;
+// UTF-8 sequence being decoded, its continuation bytes still to come and the
+// smallest code point that may use its length
+static uint32_t utf8_cp;
+static int utf8_pending;
+static uint32_t utf8_min;
+// Character sets designated to G0 and G1 by SCS, and the one shifted in by
+// SI or SO. charset_map holds the glyph of each byte under the shifted in
+// set, and charset_ascii tells when the map is the identity.
+#define CHARSET_ASCII 0
+#define CHARSET_DEC_GRAPHICS 1
+#define CHARSET_UK 2
+static uint8_t charset_g[2];
+static int charset_gl;
+static uint8_t charset_map[256];
+static bool charset_ascii = true;
 
-static void term_scroll() {
-    term_state_back->y++;
-    if (term_state_back->y >= TERM_HEIGHT) {
-        // Scroll
-        term_state_back->y --;
-        term_state_back->y_offset ++;
-        if (term_state_back->y_offset >= TERM_BUF_HEIGHT)
-            term_state_back->y_offset -= TERM_BUF_HEIGHT;
-        int cy = term_state_back->y + term_state_back->y_offset;
-        if (cy >= TERM_BUF_HEIGHT) cy -= TERM_BUF_HEIGHT;
-        for (int x = 0; x < TERM_WIDTH; x++) {
-            term_state_back->textmap[cy][x] = ' ';
-        }
+_Static_assert(TERM_BUF_HEIGHT <= 32, "dirty_rows holds one bit per row");
+
+// Buffer row holding screen row y
+static int term_row(int y) {
+    return term_state_back->rowmap[y];
+}
+
+// Buffer slot of screen row y, which is where the row sits in the frame buffer
+static int term_slot(int y) {
+    int slot = y + term_state_back->y_offset;
+    if (slot >= TERM_BUF_HEIGHT) slot -= TERM_BUF_HEIGHT;
+    return slot;
+}
+
+// Mark a range of cells on screen row y as changed, x2 is inclusive. Dirty
+// bits are kept per buffer slot.
+static void term_mark_dirty(int y, int x1, int x2) {
+    int slot = term_slot(y);
+    uint32_t bit = 1ul << slot;
+    if (term_state_back->dirty_rows & bit) {
+        if (x1 < term_state_back->dirty_x1[slot])
+            term_state_back->dirty_x1[slot] = x1;
+        if (x2 > term_state_back->dirty_x2[slot])
+            term_state_back->dirty_x2[slot] = x2;
+    }
+    else {
+        term_state_back->dirty_rows |= bit;
+        term_state_back->dirty_x1[slot] = x1;
+        term_state_back->dirty_x2[slot] = x2;
+    }
+    term_state_dirty = true;
+}
+
+static void term_mark_row_dirty(int y) {
+    term_mark_dirty(y, 0, TERM_WIDTH - 1);
+}
+
+static void term_mark_rows_dirty(int top, int bottom) {
+    for (int y = top; y <= bottom; y++) {
+        term_mark_row_dirty(y);
+    }
+}
+
+void term_invalidate(TERM_STATE *state) {
+    state->dirty_rows = 0xfffffffful >> (32 - TERM_BUF_HEIGHT);
+    memset(state->dirty_x1, 0, sizeof(state->dirty_x1));
+    memset(state->dirty_x2, TERM_WIDTH - 1, sizeof(state->dirty_x2));
+    // Every slot gets redrawn, pending row moves are of no use
+    state->scroll_op_count = 0;
+    term_state_dirty = true;
+}
+
+static void term_mark_all_dirty() {
+    term_invalidate(term_state_back);
+}
+
+static TERM_CELL term_blank_cell() {
+    return MAKE_CELL(' ', current_flag, current_color);
+}
+
+// Erase cells x1 to x2 (inclusive) of screen row y to blanks in the current
+// colors
+static void term_erase_span(int y, int x1, int x2) {
+    if (x2 < x1)
+        return;
+    term_fill_cells(term_state_back, term_row(y), x1, x2 - x1 + 1,
+            term_blank_cell());
+    term_mark_dirty(y, x1, x2);
+}
+
+// Erase screen rows top to bottom (inclusive)
+static void term_erase_rows(int top, int bottom) {
+    TERM_CELL blank = term_blank_cell();
+    for (int y = top; y <= bottom; y++)
+        term_fill_cells(term_state_back, term_row(y), 0, TERM_WIDTH, blank);
+    if (top <= bottom)
+        term_mark_rows_dirty(top, bottom);
+}
+
+static void term_clear_state(TERM_STATE *state) {
+    memset(state, 0, sizeof(*state));
+    for (int y = 0; y < TERM_BUF_HEIGHT; y++) {
+        state->rowmap[y] = y;
+    }
+}
+
+// Scroll screen rows top to bottom (inclusive) up by n lines, or down if n is
+// negative. Only the row map is rotated, the rows scrolled in are cleared.
+static void term_scroll_rows(int top, int bottom, int n) {
+    uint8_t *map = term_state_back->rowmap;
+    uint8_t recycled[TERM_BUF_HEIGHT];
+    int height = bottom - top + 1;
+    int clear_top;
+    if (n > 0) {
+        if (n > height) n = height;
+        memcpy(recycled, &map[top], n);
+        memmove(&map[top], &map[top + n], height - n);
+        memcpy(&map[bottom - n + 1], recycled, n);
+        clear_top = bottom - n + 1;
+    }
+    else {
+        n = -n;
+        if (n > height) n = height;
+        memcpy(recycled, &map[bottom - n + 1], n);
+        memmove(&map[top + n], &map[top], height - n);
+        memcpy(&map[top], recycled, n);
+        clear_top = top;
+    }
+    for (int y = clear_top; y < clear_top + n; y++) {
+        term_fill_cells(term_state_back, map[y], 0, TERM_WIDTH, term_blank_cell());
+    }
+}
+
+// Log a scroll of n lines of rows top to bottom for the front end, and move
+// their damage along with them
+static void term_move_damage(int top, int bottom, int n) {
+    TERM_STATE *state = term_state_back;
+    int height = bottom - top + 1;
+    int lines = (n > 0) ? n : -n;
+    if ((lines >= height) || (state->scroll_op_count == TERM_MAX_SCROLL_OPS)) {
+        // Nothing survives the move, or no room to log it
+        term_mark_rows_dirty(top, bottom);
+        return;
+    }
+
+    TERM_SCROLL_OP *last = (state->scroll_op_count > 0) ?
+            &state->scroll_ops[state->scroll_op_count - 1] : NULL;
+    int top_slot = term_slot(top);
+    if (last && (last->top == top_slot) && (last->height == height) &&
+            ((last->lines > 0) == (n > 0)) && (abs(last->lines + n) < height)) {
+        // Same region scrolled again in the same direction
+        last->lines += n;
+    }
+    else {
+        TERM_SCROLL_OP *op = &state->scroll_ops[state->scroll_op_count++];
+        op->top = top_slot;
+        op->height = height;
+        op->lines = n;
+    }
+
+    bool dirty[TERM_HEIGHT];
+    uint8_t x1[TERM_HEIGHT];
+    uint8_t x2[TERM_HEIGHT];
+    for (int y = top; y <= bottom; y++) {
+        int slot = term_slot(y);
+        dirty[y] = state->dirty_rows & (1ul << slot);
+        x1[y] = state->dirty_x1[slot];
+        x2[y] = state->dirty_x2[slot];
+        state->dirty_rows &= ~(1ul << slot);
+    }
+    for (int y = top; y <= bottom; y++) {
+        int src = y + n;
+        if ((src < top) || (src > bottom))
+            term_mark_row_dirty(y);
+        else if (dirty[src])
+            term_mark_dirty(y, x1[src], x2[src]);
     }
+}
+
+// Keep rows scrolling off the top of the main screen in the history
+static void term_save_history(int lines) {
+    if (term_state_back != &term_state_back_main)
+        return;
+    for (int y = 0; y < lines; y++) {
+        scrollback_push(term_state_back, term_row(y));
+    }
+}
+
+// Scroll the whole screen up by one line, by moving y_offset
+static void term_scroll_screen() {
+    term_save_history(1);
+    term_state_back->y_offset ++;
+    if (term_state_back->y_offset >= TERM_BUF_HEIGHT)
+        term_state_back->y_offset -= TERM_BUF_HEIGHT;
+    // Rows keep their buffer slot while the offset moves, so the whole
+    // map rotates by one
+    uint8_t *map = term_state_back->rowmap;
+    uint8_t top = map[0];
+    memmove(&map[0], &map[1], TERM_BUF_HEIGHT - 1);
+    map[TERM_BUF_HEIGHT - 1] = top;
+    term_fill_cells(term_state_back, term_row(TERM_HEIGHT - 1), 0, TERM_WIDTH,
+            term_blank_cell());
+    term_mark_row_dirty(TERM_HEIGHT - 1);
+}
+
+// Scroll the scrolling region up by n lines, or down if n is negative. The
+// rows are moved in the frame buffer by the front end.
+static void term_scroll_region(int n) {
+    if (n > TERM_HEIGHT) n = TERM_HEIGHT;
+    if (n < -TERM_HEIGHT) n = -TERM_HEIGHT;
+    if ((n > 0) && (scroll_top == 0))
+        term_save_history((n > scroll_bottom) ? scroll_bottom + 1 : n);
+    if (n != 0) {
+        term_scroll_rows(scroll_top, scroll_bottom, n);
+        term_move_damage(scroll_top, scroll_bottom, n);
+    }
+    term_state_dirty = true;
+}
+
+// Move the cursor down one line, scrolling at the bottom margin
+static void term_scroll() {
+    if ((term_state_back->y == scroll_bottom) && (scroll_top == 0) &&
+            (scroll_bottom == TERM_HEIGHT - 1))
+        term_scroll_screen();
+    else if (term_state_back->y == scroll_bottom)
+        term_scroll_region(1);
+    else if (term_state_back->y < TERM_HEIGHT - 1)
+        term_state_back->y++;
+    pending_wrap = false;
+    term_state_dirty = true;
+}
+
+// Move the cursor up one line, scrolling at the top margin
+static void term_reverse_scroll() {
+    if (term_state_back->y == scroll_top)
+        term_scroll_region(-1);
+    else if (term_state_back->y > 0)
+        term_state_back->y--;
     pending_wrap = false;
     term_state_dirty = true;
 }
@@ -144,6 +385,7 @@ static void term_dec_modeset(int mode, bool enable) {
             term_state_back = &term_state_back_alternate;
         else
             term_state_back = &term_state_back_main;
+        term_mark_all_dirty();
     }
     else if (mode == 1048) {
         if (enable) {
@@ -167,12 +409,16 @@ static void term_dec_modeset(int mode, bool enable) {
             term_state_back->x = alt_x;
             term_state_back->y = alt_y;
         }   
-        memset(term_state_back, 0, sizeof(*term_state_back));
-        term_state_dirty = true;
+        term_clear_state(term_state_back);
+        term_mark_all_dirty();
     }
     else if (mode == 2004) {
         // Bracketed paste mode. Ignore
     }
+    else if (mode == 2026) {
+        // Synchronized update, the front end holds the screen meanwhile
+        mode_synchronized_update = enable;
+    }
     else {
         fprintf(stderr, "Unsupported DEC mode: %d", mode);
     }
@@ -193,12 +439,8 @@ static void term_modeset(int mode, bool enable) {
 }
 
 static void term_put_char(int x, int y, char c) {
-    int ay = y + term_state_back->y_offset;
-    if (ay >= TERM_BUF_HEIGHT) ay -= TERM_BUF_HEIGHT;
-    term_state_back->textmap[ay][x] = c;
-    term_state_back->flagmap[ay][x] = current_flag;
-    term_state_back->colormap[ay][x] = current_color;
-    term_state_dirty = true;
+    term_set_cell(term_state_back, term_row(y), x, MAKE_CELL(c, current_flag, current_color));
+    term_mark_dirty(y, x, x);
     //printf("putc %d %d = %c\n", x, y, c);
 }
 
@@ -215,16 +457,19 @@ static void term_set_bg(char bg) {
 static void term_cursor_down(int lines) {
     int x = term_state_back->x;
     int y = term_state_back->y;
+    // Stop at the bottom margin unless already below it
+    int limit = (y <= scroll_bottom) ? scroll_bottom : TERM_HEIGHT - 1;
     y += lines;
-    if (y >= TERM_HEIGHT) y = TERM_HEIGHT - 1;
+    if (y > limit) y = limit;
     term_cursor_set(x, y);
 }
 
 static void term_cursor_up(int lines) {
     int x = term_state_back->x;
     int y = term_state_back->y;
+    int limit = (y >= scroll_top) ? scroll_top : 0;
     y -= lines;
-    if (y < 0) y = 0;
+    if (y < limit) y = limit;
     term_cursor_set(x, y);
 }
 
@@ -265,52 +510,31 @@ static void term_backward_tab() {
 static void term_shift_right(int shift) {
     int x = term_state_back->x;
     int y = term_state_back->y;
-    for (int xx = TERM_WIDTH - 1; xx >= x + shift; xx--) {
-        term_state_back->textmap[y][xx] = term_state_back->textmap[y][xx - shift];
-        term_state_back->colormap[y][xx] = term_state_back->colormap[y][xx - shift];
-        term_state_back->flagmap[y][xx] = term_state_back->flagmap[y][xx - shift];
-    }
-    for (int xx = x; xx < x + shift; xx++) {
-        if (xx >= TERM_WIDTH)
-            break;
-        term_state_back->textmap[y][xx] = ' ';
-        term_state_back->colormap[y][xx] = current_color;
-        term_state_back->flagmap[y][xx] = current_flag;
-    }
-    term_state_dirty = true;
+    if (shift > TERM_WIDTH - x)
+        shift = TERM_WIDTH - x;
+    term_move_cells(term_state_back, term_row(y), x + shift, x, TERM_WIDTH - x - shift);
+    term_fill_cells(term_state_back, term_row(y), x, shift, term_blank_cell());
+    term_mark_dirty(y, x, TERM_WIDTH - 1);
 }
 
+// Insert or delete lines at the cursor, only inside the scrolling region
 static void term_shift_down(int shift) {
-    int x = term_state_back->x;
     int y = term_state_back->y;
-    for (int yy = TERM_BUF_HEIGHT - 1; yy >= y + shift; yy--){
-        memcpy(term_state_back->textmap[yy], term_state_back->textmap[yy - shift], TERM_WIDTH);
-        memcpy(term_state_back->colormap[yy], term_state_back->colormap[yy - shift], TERM_WIDTH);
-        memcpy(term_state_back->flagmap[yy], term_state_back->flagmap[yy - shift], TERM_WIDTH);
-    }
-    for (int yy = y; yy < y + shift; yy++) {
-        if (yy >= TERM_BUF_HEIGHT)
-            break;
-        memset(term_state_back->textmap[yy], ' ', TERM_WIDTH);
-        memset(term_state_back->colormap[yy], current_color, TERM_WIDTH);
-        memset(term_state_back->flagmap[yy], current_flag, TERM_WIDTH);
-    }
+    if ((y < scroll_top) || (y > scroll_bottom))
+        return;
+    term_scroll_rows(y, scroll_bottom, -shift);
+    // The front end moves the rows instead of redrawing them
+    term_move_damage(y, scroll_bottom, -shift);
     term_state_dirty = true;
 }
 
 static void term_shift_up(int shift) {
-    int x = term_state_back->x;
     int y = term_state_back->y;
-    for (int yy = y; yy < TERM_BUF_HEIGHT - shift; yy++){
-        memcpy(term_state_back->textmap[yy], term_state_back->textmap[yy + shift], TERM_WIDTH);
-        memcpy(term_state_back->colormap[yy], term_state_back->colormap[yy + shift], TERM_WIDTH);
-        memcpy(term_state_back->flagmap[yy], term_state_back->flagmap[yy + shift], TERM_WIDTH);
-    }
-    for (int yy = TERM_BUF_HEIGHT - shift; yy < TERM_BUF_HEIGHT; yy++) {
-        memset(term_state_back->textmap[yy], ' ', TERM_WIDTH);
-        memset(term_state_back->colormap[yy], current_color, TERM_WIDTH);
-        memset(term_state_back->flagmap[yy], current_flag, TERM_WIDTH);
-    }
+    if ((y < scroll_top) || (y > scroll_bottom))
+        return;
+    term_scroll_rows(y, scroll_bottom, shift);
+    // The front end moves the rows instead of redrawing them
+    term_move_damage(y, scroll_bottom, shift);
     term_state_dirty = true;
 }
 
@@ -326,6 +550,31 @@ static void term_report_cursor(bool dec_mode) {
     serial_puts(str);
 }
 
+// Code points of 0x5f to 0x7e in the DEC Special Graphics set
+static const uint16_t charset_dec_graphics[32] = {
+    0x00a0, 0x25c6, 0x2592, 0x2409, 0x240c, 0x240d, 0x240a, 0x00b0,
+    0x00b1, 0x2424, 0x240b, 0x2518, 0x2510, 0x250c, 0x2514, 0x253c,
+    0x23ba, 0x23bb, 0x2500, 0x23bc, 0x23bd, 0x251c, 0x2524, 0x2534,
+    0x252c, 0x2502, 0x2264, 0x2265, 0x03c0, 0x2260, 0x00a3, 0x00b7,
+};
+
+// Rebuild charset_map after the designated or shifted in set changed
+static void term_charset_update() {
+    int set = charset_g[charset_gl];
+    for (int c = 0; c < 256; c++)
+        charset_map[c] = c;
+    if (set == CHARSET_DEC_GRAPHICS) {
+        for (int c = 0x5f; c <= 0x7e; c++) {
+            uint8_t glyph = unicode_to_glyph(charset_dec_graphics[c - 0x5f]);
+            charset_map[c] = glyph ? glyph : UNICODE_REPLACEMENT;
+        }
+    }
+    else if (set == CHARSET_UK) {
+        charset_map['#'] = unicode_to_glyph(0x00a3);
+    }
+    charset_ascii = (set == CHARSET_ASCII);
+}
+
 static void term_reset() {
     saved_x = 0;
     saved_y = 0;
@@ -338,594 +587,984 @@ static void term_reset() {
     mode_app_cursor = false;
     mode_cursor_blinking = true;
     mode_show_cursor = true;
+    mode_synchronized_update = false;
     mode_insert = false;
     mode_auto_newline = false;
+    mode_utf8 = true;
     pending_wrap = false;
+    scroll_top = 0;
+    scroll_bottom = TERM_HEIGHT - 1;
+    scrollback_clear();
     last_graph_char = '\0';
+    charset_g[0] = CHARSET_ASCII;
+    charset_g[1] = CHARSET_ASCII;
+    charset_gl = 0;
+    saved_charset_g[0] = CHARSET_ASCII;
+    saved_charset_g[1] = CHARSET_ASCII;
+    saved_charset_gl = 0;
+    term_charset_update();
     term_state_back = &term_state_back_main;
-    memset(term_state_back, 0, sizeof(*term_state_back));
+    term_clear_state(term_state_back);
+    term_mark_all_dirty();
 }
 
-void term_process_char(uint8_t c) {
-    // States
-    static char csi[5];
-    static int csi_codes[5];
-    static int arg_counter = 0;
-    static int chr_counter = 0;
-    static int osc_type = 0;
-    static PARSER_STATE state = ST_NORMAL;
-    static bool dec_set = false;
-
-    // ANSI behavior
-    //term_cursor_check(); // force flush?
+// Print one glyph at the cursor
+static void term_print_glyph(uint8_t c) {
+    last_graph_char = c;
+    term_cursor_check();
+    if (mode_insert) {
+        term_shift_right(1);
+    }
+    term_put_char(term_state_back->x, term_state_back->y, c);
+    term_cursor_forward();
+}
 
+static void term_print_code_point(uint32_t cp) {
+    uint8_t glyph = unicode_to_glyph(cp);
+    if (glyph) {
+        term_print_glyph(glyph);
+        return;
+    }
+    // Keep the columns in step with the host for chars without a glyph
+    int width = unicode_width(cp);
+    for (int i = 0; i < width; i++)
+        term_print_glyph(UNICODE_REPLACEMENT);
+}
+
+// ESC sequence handlers, dispatched by final char
+static void term_esc_decsc() {
+    // DECSC: Save Cursor
+    saved_x = term_state_back->x;
+    saved_y = term_state_back->y;
+    saved_color = current_color;
+    saved_flag = current_flag;
+    saved_charset_g[0] = charset_g[0];
+    saved_charset_g[1] = charset_g[1];
+    saved_charset_gl = charset_gl;
+}
+
+static void term_esc_decrc() {
+    // DECRC: Restore Cursor
+    term_state_back->x = saved_x;
+    term_state_back->y = saved_y;
+    current_color = saved_color;
+    current_flag = saved_flag;
+    charset_g[0] = saved_charset_g[0];
+    charset_g[1] = saved_charset_g[1];
+    charset_gl = saved_charset_gl;
+    term_charset_update();
+}
+
+static void term_esc_ind() {
+    // IND: Index
+    term_scroll();
+}
+
+static void term_esc_nel() {
+    // NEL: Next Line
+    term_cursor_check();
+    term_scroll();
+    term_cursor_set(0, term_state_back->y);
+}
+
+static void term_esc_ri() {
+    // RI: Reverse Index
+    term_reverse_scroll();
+}
+
+static void term_esc_decid() {
+    // DECID: Identify
+    term_report_dev_attributes();
+}
+
+static void term_esc_ris() {
+    // RIS: Reset to Initial State
+    term_reset();
+}
+
+static void term_esc_decpam() {
+    // DECPAM: Application Keypad
+    mode_app_keypad = true;
+}
+
+static void term_esc_decpnm() {
+    // DECPNM: Normal Keypad
+    mode_app_keypad = false;
+}
+
+// CSI sequence handlers, dispatched by final char
+static void term_csi_sgr() {
+    // SGR sequcne
+    if (arg_counter == 0) {
+        csi_codes[0] = 0;
+        arg_counter = 1;
+    }
+    for (int i = 0; i < arg_counter; i++) {
+        switch (csi_codes[i]) {
+        case 0: // Reset
+            current_flag = 0;
+            current_color = DEFAULT_COLOR;
+            break;
+        case 1: // Bold
+            current_flag |= FLAG_BOLD; break;
+        case 3: // Italic
+            current_flag |= FLAG_ITALIC; break;
+        case 4: // Underline
+            current_flag |= FLAG_UNDERLINE; break;
+        case 5: // Slow blink
+            current_flag |= FLAG_SLOWBLINK; break;
+        case 7:
+            current_flag |= FLAG_INVERT; break;
+        case 9: // Croseed out
+            current_flag |= FLAG_STHROUGH; break;
+        case 10: // Default font, ignored
+            break;
+        case 22: // Bold off
+            current_flag &= ~FLAG_BOLD; break;
+        case 23: // Italic off
+            current_flag &= ~FLAG_ITALIC; break;
+        case 24: // Underline off
+            current_flag &= ~FLAG_UNDERLINE; break;
+        case 25: // Blink off
+            current_flag &= ~FLAG_SLOWBLINK; break;
+        case 26: // Crossed out off
+            current_flag &= ~FLAG_STHROUGH; break;
+        case 27:
+            current_flag &= ~FLAG_INVERT; break;
+        case 30: term_set_fg(COLOR_BLACK); break;
+        case 31: term_set_fg(COLOR_RED); break;
+        case 32: term_set_fg(COLOR_GREEN); break;
+        case 33: term_set_fg(COLOR_BROWN); break;
+        case 34: term_set_fg(COLOR_BLUE); break;
+        case 35: term_set_fg(COLOR_MAGENTA); break;
+        case 36: term_set_fg(COLOR_CYAN); break;
+        case 37: term_set_fg(COLOR_WHITE); break;
+        case 39: term_set_fg(COLOR_WHITE); break;
+        case 90: term_set_fg(COLOR_GRAY); break;
+        case 91: term_set_fg(COLOR_BRIGHT_RED); break;
+        case 92: term_set_fg(COLOR_BRIGHT_GREEN); break;
+        case 93: term_set_fg(COLOR_BRIGHT_YELLOW); break;
+        case 94: term_set_fg(COLOR_BRIGHT_BLUE); break;
+        case 95: term_set_fg(COLOR_BRIGHT_MAGENTA); break;
+        case 96: term_set_fg(COLOR_BRIGHT_CYAN); break;
+        case 97: term_set_fg(COLOR_BRIGHT_WHITE); break;
+        case 40: term_set_bg(COLOR_BLACK); break;
+        case 41: term_set_bg(COLOR_RED); break;
+        case 42: term_set_bg(COLOR_GREEN); break;
+        case 43: term_set_bg(COLOR_BROWN); break;
+        case 44: term_set_bg(COLOR_BLUE); break;
+        case 45: term_set_bg(COLOR_MAGENTA); break;
+        case 46: term_set_bg(COLOR_CYAN); break;
+        case 47: term_set_bg(COLOR_WHITE); break;
+        case 49: term_set_bg(COLOR_BLACK); break;
+        case 100:term_set_bg(COLOR_GRAY); break;
+        case 101:term_set_bg(COLOR_BRIGHT_RED); break;
+        case 102:term_set_bg(COLOR_BRIGHT_GREEN); break;
+        case 103:term_set_bg(COLOR_BRIGHT_YELLOW); break;
+        case 104:term_set_bg(COLOR_BRIGHT_BLUE); break;
+        case 105:term_set_bg(COLOR_BRIGHT_MAGENTA); break;
+        case 106:term_set_bg(COLOR_BRIGHT_CYAN); break;
+        case 107:term_set_bg(COLOR_BRIGHT_WHITE); break;
+        default:
+            fprintf(stderr, "Unsupported SGR code: %d", csi_codes[i]);
+        }
+    }
+}
+
+static void term_csi_cuu() {
+    // CUU: Cursor Up
+    if (arg_counter == 0) csi_codes[0] = 1;
+    term_cursor_up(csi_codes[0]);
+}
+
+static void term_csi_cud() {
+    // CUD: Cursor Down
+    if (arg_counter == 0) csi_codes[0] = 1;
+    term_cursor_down(csi_codes[0]);
+}
+
+static void term_csi_cuf() {
+    // CUF: Cursor Forward
+    if (arg_counter == 0) csi_codes[0] = 1;
+    int x = term_state_back->x + csi_codes[0];
+    if (x >= TERM_WIDTH) x = TERM_WIDTH - 1;
+    term_cursor_set(x, term_state_back->y);
+}
+
+static void term_csi_cub() {
+    // CUB: Cursor Back
+    if (arg_counter == 0) csi_codes[0] = 1;
+    int x = term_state_back->x - csi_codes[0];
+    if (x < 0) x = 0;
+    term_cursor_set(x, term_state_back->y);
+}
+
+static void term_csi_cnl() {
+    // CNL: next line
+    if (arg_counter == 0) csi_codes[0] = 1;
+    term_cursor_down(csi_codes[0]);
+    term_cursor_set(0, term_state_back->y);
+}
+
+static void term_csi_cpl() {
+    // CPL: previous line
+    if (arg_counter == 0) csi_codes[0] = 1;
+    term_cursor_up(csi_codes[0]);
+    term_cursor_set(0, term_state_back->y);
+}
+
+static void term_csi_cha() {
+    // CHA: Cursor Character Absolute
+    // HPA: Character Position Absolute
+    if ((arg_counter == 0) || (csi_codes[0] == 0)) csi_codes[0] = 1;
+    int x = csi_codes[0] - 1;
+    if (x >= TERM_WIDTH) x = TERM_WIDTH - 1;
+    term_cursor_set(x, term_state_back->y);
+}
+
+static void term_csi_cht() {
+    // CHT
+    if (arg_counter == 0) csi_codes[0] = 1;
+    for (int i = 0; i < csi_codes[0]; i++) {
+        term_forward_tab();
+    }
+}
+
+static void term_csi_vpa() {
+    // VPA
+    if ((arg_counter == 0) || (csi_codes[0] == 0)) csi_codes[0] = 1;
+    int y = csi_codes[0] - 1;
+    if (y >= TERM_HEIGHT) y = TERM_HEIGHT - 1;
+    term_cursor_set(term_state_back->x, y);
+}
+
+static void term_csi_cup() {
+    // CUP: Cursor Position
+    // HVP: Horizontal Vertical Position
+    if (arg_counter < 2)
+        csi_codes[1] = 1;
+    if (arg_counter < 1)
+        csi_codes[0] = 1;
+    int y = csi_codes[0] - 1;
+    int x = csi_codes[1] - 1;
+    if (x < 0) x = 0;
+    if (x >= TERM_WIDTH) x= TERM_WIDTH - 1;
+    if (y < 0) y = 0;
+    if (y >= TERM_HEIGHT) y = TERM_HEIGHT - 1;
+    term_cursor_set(x, y);
+}
+
+static void term_csi_el() {
+    // EL: Erase in Line
     int x = term_state_back->x;
     int y = term_state_back->y;
+    if (arg_counter == 0) csi_codes[0] = 0;
+    if (csi_codes[0] == 0) {
+        term_erase_span(y, x, TERM_WIDTH - 1);
+    }
+    else if (csi_codes[0] == 1) {
+        term_erase_span(y, 0, x);
+    }
+    else {
+        term_erase_span(y, 0, TERM_WIDTH - 1);
+    }
+}
 
-    //printf("Processing char %c at %d, %d\n", c, x, y);
+static void term_csi_ed() {
+    // ED: Erase in Display
+    int x = term_state_back->x;
+    int y = term_state_back->y;
+    if (arg_counter == 0) csi_codes[0] = 0;
+    if (csi_codes[0] == 0) {
+        term_erase_span(y, x, TERM_WIDTH - 1);
+        term_erase_rows(y + 1, TERM_HEIGHT - 1);
+    }
+    else if (csi_codes[0] == 1) {
+        term_erase_rows(0, y - 1);
+        term_erase_span(y, 0, x);
+    }
+    else if (csi_codes[0] == 2) {
+        term_erase_rows(0, TERM_HEIGHT - 1);
+    }
+    else if (csi_codes[0] == 3) {
+        // Erase the history, the screen stays
+        scrollback_clear();
+    }
+}
 
-    if (state == ST_NORMAL) {
-        if ((c == 0x08) || (c == 0x7f)) {
-            // BS
-            term_cursor_backward();
-        }
-        else if (c == 0x0d) {
-            // CR
-            term_cursor_set(0, term_state_back->y);
-            if (mode_auto_newline)
-                term_scroll();
-        }
-        else if ((c == 0x0a) || (c == 0x0b) || (c == 0x0c)) {
-            // LF
-            term_scroll();
-            term_cursor_set(0, term_state_back->y);
-        }
-        else if (c == 0x09) {
-            // Tab
-            term_forward_tab();
-        }
-        else if (c == 0x07) {
-            // Bell
-        }
-        else if (c == 0x1b) {
-            state = ST_ANSI_ESCAPE;
-        }
-        else if (c == 0xff) {
-            fprintf(stderr, "IAC?\n");
-        }
-        else {
-            last_graph_char = c;
-            if (mode_insert) {
-                term_cursor_check();
-                term_shift_right(1);
-                term_put_char(term_state_back->x, term_state_back->y, c);
-                term_cursor_forward();
-            }
-            else {
-                term_cursor_check();
-                term_put_char(term_state_back->x, term_state_back->y, c);
-                term_cursor_forward();
-            }
-            
-        }
+static void term_csi_il() {
+    // IL: Insert Lines
+    if (arg_counter == 0) csi_codes[0] = 1;
+    term_shift_down(csi_codes[0]);
+}
+
+static void term_csi_dl() {
+    // DL: Delete Lines
+    if (arg_counter == 0) csi_codes[0] = 1;
+    term_shift_up(csi_codes[0]);
+}
+
+static void term_csi_dsr() {
+    // DSR: Device Status Report
+    if (arg_counter == 0) csi_codes[0] = 0;
+    if (dec_set && (csi_codes[0] == 9000)) {
+        // Private: report the profiling counters as a DCS string
+        char str[320];
+        int len = snprintf(str, sizeof(str), "\eP9000;");
+        len += prof_report(str + len, sizeof(str) - len - 2);
+        strcpy(str + len, "\e\\");
+        serial_puts(str);
     }
-    else if (state == ST_ANSI_ESCAPE) {
-        if (c == '[') {
-            state = ST_CSI_SEQ;
-            dec_set = false;
-            arg_counter = 0;
-            chr_counter = 0;
-        }
-        else if (c == '#') {
-            state = ST_LSC_SEQ;
-        }
-        else if (c == '(') {
-            state = ST_G0S_SEQ;
-        }
-        else if (c == ')') {
-            state = ST_G1S_SEQ;
-        }
-        else if (c == ']') {
-            state = ST_OSC_SEQ;
-            chr_counter = 0;
-        }
-        else if (c == '7') {
-            // DECSC: Save Cursor
-            saved_x = term_state_back->x;
-            saved_y = term_state_back->y;
-            saved_color = current_color;
-            saved_flag = current_flag;
-            state = ST_NORMAL;
-        }
-        else if (c == '8') {
-            // DECRC: Restore Cursor
-            term_state_back->x = saved_x;
-            term_state_back->y = saved_y;
-            current_color = saved_color;
-            current_flag = saved_flag;
-            state = ST_NORMAL;
-        }
-        else if (c == 'D') {
-            // IND: Index
-            term_cursor_down(1);
-            state = ST_NORMAL;
-        }
-        else if (c == 'E') {
-            // NEL: Next Line
-            term_cursor_check();
-            term_scroll();
-            term_cursor_set(0, term_state_back->y);
-            state = ST_NORMAL;
-        }
-        else if (c == 'M') {
-            // RI: Reverse Index
-            term_cursor_up(1);
-            state = ST_NORMAL;
-        }
-        else if (c == 'Z') {
-            // DECID: Identify
-            term_report_dev_attributes();
-            state = ST_NORMAL;
-        }
-        else if (c == 'c') {
-            // RIS: Reset to Initial State
-            term_reset();
-            state = ST_NORMAL;
-        }
-        else if (c == '=') {
-            // DECPAM: Application Keypad
-            mode_app_keypad = true;
-            state = ST_NORMAL;
-        }
-        else if (c == '>') {
-            // DECPNM: Normal Keypad
-            mode_app_keypad = false;
-            state = ST_NORMAL;
-        }
-        else {
-            fprintf(stderr, "Unsupported escape sequence: %c (%d)", c, c);
-            state = ST_NORMAL;
-        }
+    else if (dec_set && (csi_codes[0] == 9001)) {
+        // Private: clear the profiling counters
+        prof_reset();
     }
-    else if (state == ST_CSI_SEQ) {
-        if ((c >= 0x30) && (c <= 0x39)) {
-            csi[chr_counter++] = c;
-            if (chr_counter > 4) {
-                fprintf(stderr, "CSI sequence argument too long");
-                state = ST_NORMAL;
-            }
-        }
-        else {
-            csi[chr_counter] = '\0';
-            if (chr_counter != 0) {
-                csi_codes[arg_counter++] = atoi(csi);
-                chr_counter = 0;
-            }
-            if (arg_counter > 4) {
-                fprintf(stderr, "Too many arguments in one CSI sequence");
-                state = ST_NORMAL;
-                return;
-            }
-            
-            if (c == 'm') {
-                // SGR sequcne
-                if (arg_counter == 0) {
-                    csi_codes[0] = 0;
-                    arg_counter = 1;
-                }
-                for (int i = 0; i < arg_counter; i++) {
-                    switch (csi_codes[i]) {
-                    case 0: // Reset
-                        current_flag = 0;
-                        current_color = DEFAULT_COLOR;
-                        break;
-                    case 1: // Bold
-                        current_flag |= FLAG_BOLD; break;
-                    case 3: // Italic
-                        current_flag |= FLAG_ITALIC; break;
-                    case 4: // Underline
-                        current_flag |= FLAG_UNDERLINE; break;
-                    case 5: // Slow blink
-                        current_flag |= FLAG_SLOWBLINK; break;
-                    case 7:
-                        current_flag |= FLAG_INVERT; break;
-                    case 9: // Croseed out
-                        current_flag |= FLAG_STHROUGH; break;
-                    case 10: // Default font, ignored
-                        break;
-                    case 22: // Bold off
-                        current_flag &= ~FLAG_BOLD; break;
-                    case 23: // Italic off
-                        current_flag &= ~FLAG_ITALIC; break;
-                    case 24: // Underline off
-                        current_flag &= ~FLAG_UNDERLINE; break;
-                    case 25: // Blink off
-                        current_flag &= ~FLAG_SLOWBLINK; break;
-                    case 26: // Crossed out off
-                        current_flag &= ~FLAG_STHROUGH; break;
-                    case 27:
-                        current_flag &= ~FLAG_INVERT; break;
-                    case 30: term_set_fg(COLOR_BLACK); break;
-                    case 31: term_set_fg(COLOR_RED); break;
-                    case 32: term_set_fg(COLOR_GREEN); break;
-                    case 33: term_set_fg(COLOR_BROWN); break;
-                    case 34: term_set_fg(COLOR_BLUE); break;
-                    case 35: term_set_fg(COLOR_MAGENTA); break;
-                    case 36: term_set_fg(COLOR_CYAN); break;
-                    case 37: term_set_fg(COLOR_WHITE); break;
-                    case 39: term_set_fg(COLOR_WHITE); break;
-                    case 90: term_set_fg(COLOR_GRAY); break;
-                    case 91: term_set_fg(COLOR_BRIGHT_RED); break;
-                    case 92: term_set_fg(COLOR_BRIGHT_GREEN); break;
-                    case 93: term_set_fg(COLOR_BRIGHT_YELLOW); break;
-                    case 94: term_set_fg(COLOR_BRIGHT_BLUE); break;
-                    case 95: term_set_fg(COLOR_BRIGHT_MAGENTA); break;
-                    case 96: term_set_fg(COLOR_BRIGHT_CYAN); break;
-                    case 97: term_set_fg(COLOR_BRIGHT_WHITE); break;
-                    case 40: term_set_bg(COLOR_BLACK); break;
-                    case 41: term_set_bg(COLOR_RED); break;
-                    case 42: term_set_bg(COLOR_GREEN); break;
-                    case 43: term_set_bg(COLOR_BROWN); break;
-                    case 44: term_set_bg(COLOR_BLUE); break;
-                    case 45: term_set_bg(COLOR_MAGENTA); break;
-                    case 46: term_set_bg(COLOR_CYAN); break;
-                    case 47: term_set_bg(COLOR_WHITE); break;
-                    case 49: term_set_bg(COLOR_BLACK); break;
-                    case 100:term_set_bg(COLOR_GRAY); break;
-                    case 101:term_set_bg(COLOR_BRIGHT_RED); break;
-                    case 102:term_set_bg(COLOR_BRIGHT_GREEN); break;
-                    case 103:term_set_bg(COLOR_BRIGHT_YELLOW); break;
-                    case 104:term_set_bg(COLOR_BRIGHT_BLUE); break;
-                    case 105:term_set_bg(COLOR_BRIGHT_MAGENTA); break;
-                    case 106:term_set_bg(COLOR_BRIGHT_CYAN); break;
-                    case 107:term_set_bg(COLOR_BRIGHT_WHITE); break;
-                    default:
-                        fprintf(stderr, "Unsupported SGR code: %d", csi_codes[i]);
-                    }
-                }
-                state = ST_NORMAL;
-            }
-            else if (c == '?') {
-                dec_set = true;
-            }
-            else if (c == 'A') {
-                // CUU: Cursor Up
-                if (arg_counter == 0) csi_codes[0] = 1;
-                term_cursor_up(csi_codes[0]);
-                state = ST_NORMAL;
-            }
-            else if (c == 'B') {
-                // CUD: Cursor Down
-                if (arg_counter == 0) csi_codes[0] = 1;
-                term_cursor_down(csi_codes[0]);
-                state = ST_NORMAL;
-            }
-            else if (c == 'C') {
-                // CUF: Cursor Forward
-                if (arg_counter == 0) csi_codes[0] = 1;
-                x += csi_codes[0];
-                if (x >= TERM_WIDTH) x = TERM_WIDTH - 1;
-                term_cursor_set(x, y);
-                state = ST_NORMAL;
-            }
-            else if (c == 'D') {
-                // CUB: Cursor Back
-                if (arg_counter == 0) csi_codes[0] = 1;
-                x -= csi_codes[0];
-                if (x < 0) x = 0;
-                term_cursor_set(x, y);
-                state = ST_NORMAL;
-            }
-            else if (c == 'E') {
-                // CNL: next line
-                if (arg_counter == 0) csi_codes[0] = 1;
-                term_cursor_down(csi_codes[0]);
-                term_cursor_set(0, term_state_back->y);
-                state = ST_NORMAL;
-            }
-            else if (c == 'F') {
-                // CPL: previous line
-                if (arg_counter == 0) csi_codes[0] = 1;
-                term_cursor_up(csi_codes[0]);
-                term_cursor_set(0, term_state_back->y);
-                state = ST_NORMAL;
-            }
-            else if ((c == 'G') || (c == '`')) {
-                // CHA: Cursor Character Absolute
-                // HPA: Character Position Absolute
-                if (arg_counter == 0) csi_codes[0] = 1;
-                x = csi_codes[0] - 1;
-                term_cursor_set(x, y);
-                state = ST_NORMAL;
-            }
-            else if (c == 'I') {
-                // CHT
-                if (arg_counter == 0) csi_codes[0] = 1;
-                for (int i = 0; i < csi_codes[0]; i++) {
-                    term_forward_tab();
-                }
-                state = ST_NORMAL;
-            }
-            else if (c == 'd') {
-                // VPA
-                if (arg_counter == 0) csi_codes[0] = 1;
-                y = csi_codes[0] - 1;
-                term_cursor_set(x, y);
-                state = ST_NORMAL;
-            }
-            else if ((c == 'H') || (c == 'f')) {
-                // CUP: Cursor Position
-                // HVP: Horizontal Vertical Position
-                if (arg_counter < 2)
-                    csi_codes[1] = 1;
-                if (arg_counter < 1)
-                    csi_codes[0] = 1;
-                y = csi_codes[0] - 1;
-                x = csi_codes[1] - 1;
-                if (x < 0) x = 0;
-                if (x >= TERM_WIDTH) x= TERM_WIDTH - 1;
-                if (y < 0) y = 0;
-                if (y >= TERM_HEIGHT) y = TERM_HEIGHT - 1;
-                term_cursor_set(x, y);
-                state = ST_NORMAL;
-            }
-            else if (c == 'K') {
-                // EL: Erase in Line
-                if (arg_counter == 0) csi_codes[0] = 0;
-                if (csi_codes[0] == 0) {
-                    for (; x < TERM_WIDTH; x++) {
-                        term_put_char(x, y, ' ');
-                    }
-                }
-                else if (csi_codes[0] == 1) {
-                    for (int xx = 0; xx <= x; xx++) {
-                        term_put_char(xx, y, ' ');
-                    }
-                }
-                else {
-                    for (x = 0; x < TERM_WIDTH; x++) {
-                        term_put_char(x, y, ' ');
-                    }
-                }
-                state = ST_NORMAL;
-            }
-            else if (c == 'J') {
-                // ED: Erase in Display
-                if (arg_counter == 0) csi_codes[0] = 0;
-                if (csi_codes[0] == 0) {
-                    for (int xx = x; xx < TERM_WIDTH; xx++) {
-                        term_put_char(xx, y, ' ');
-                    }
-                    for (int yy = y + 1; yy < TERM_HEIGHT; yy++) {
-                        for (int xx = 0; xx < TERM_WIDTH; xx++) {
-                            term_put_char(xx, yy, ' ');
-                        }
-                    }
-                }
-                else if (csi_codes[0] == 1) {
-                    for (int yy = 0; yy < y; yy++) {
-                        for (int xx = 0; xx < TERM_WIDTH; xx++) {
-                            term_put_char(xx, yy, ' ');
-                        }
-                    }
-                    for (int xx = 0; xx <= x; xx++) {
-                        term_put_char(xx, y, ' ');
-                    }
-                }
-                else {
-                    for (y = 0; y < TERM_HEIGHT; y++) {
-                        for (x = 0; x < TERM_WIDTH; x++) {
-                            term_put_char(x, y, ' ');
-                        }
-                    }
-                }
-                state = ST_NORMAL;
-            }
-            else if (c == 'L') {
-                // IL: Insert Lines
-                if (arg_counter == 0) csi_codes[0] = 1;
-                term_shift_down(csi_codes[0]);
-                state = ST_NORMAL;
-            }
-            else if (c == 'M') {
-                // DL: Delete Lines
-                if (arg_counter == 0) csi_codes[0] = 1;
-                term_shift_up(csi_codes[0]);
-                state = ST_NORMAL;
-            }
-            else if (c == 'n') {
-                // DSR: Device Status Report
-                if (csi_codes[0] == 5) {
-                    serial_puts("\e[0n"); // Ready
-                }
-                else if (csi_codes[0] == 6) {
-                    term_report_cursor(dec_set);
-                }
-                state = ST_NORMAL;
-            }
-            else if (c == 'c') {
-                // DA: Device Attributes
-                term_report_dev_attributes();
-                state = ST_NORMAL;
-            }
-            else if (c == '@') {
-                // ICH: Insert Character
-                if (arg_counter == 0) csi_codes[0] = 1;
-                int shift = csi_codes[0];
-                term_shift_right(shift);
-                state = ST_NORMAL;
-            }
-            else if (c == 'P') {
-                // DCH: Delete Character
-                if (arg_counter == 0) csi_codes[0] = 1;
-                int shift = csi_codes[0];
-                if (shift > (TERM_WIDTH - x))
-                    shift = TERM_WIDTH - x;
-                for (int xx = x; xx < (TERM_WIDTH - shift); xx++) {
-                    term_state_back->textmap[y][xx] = term_state_back->textmap[y][xx + shift];
-                    term_state_back->colormap[y][xx] = term_state_back->colormap[y][xx + shift];
-                    term_state_back->flagmap[y][xx] = term_state_back->flagmap[y][xx + shift];
-                }
-                for (int xx = TERM_WIDTH - shift; xx < TERM_WIDTH; xx++) {
-                    term_state_back->textmap[y][xx] = ' ';
-                    term_state_back->colormap[y][xx] = current_color;
-                    term_state_back->flagmap[y][xx] = current_flag;
-                }
-                term_state_dirty = true;
-                state = ST_NORMAL;
-            }
-            else if (c == 'X') {
-                // ECH: Erase Character
-                if (arg_counter == 1) {
-                    int shift = csi_codes[0];
-                    if (shift > (TERM_WIDTH - x))
-                        shift = TERM_WIDTH - x;
-                    for (int xx = x; xx < x + shift; xx++) {
-                        term_state_back->textmap[y][xx] = ' ';
-                        term_state_back->colormap[y][xx] = current_color;
-                        term_state_back->flagmap[y][xx] = current_flag;
-                    }
-                    term_state_dirty = true;
-                }
-                state = ST_NORMAL;
-            }
-            else if (c == 'S') {
-                // SU: Shift Up
-                if (arg_counter == 0) csi_codes[0] = 1;
-                int y = term_state_back->y;
-                term_state_back->y = 0;
-                term_shift_up(csi_codes[0]);
-                term_state_back->y = y;
-                state = ST_NORMAL;
-            }
-            else if (c == 'T') {
-                // SD: Shift Down
-                if (arg_counter == 0) csi_codes[0] = 1;
-                int y = term_state_back->y;
-                term_state_back->y = 0;
-                term_shift_down(csi_codes[0]);
-                term_state_back->y = y;
-                state = ST_NORMAL;
-            }
-            else if (c == 'Z') {
-                // CBT
-                if (arg_counter == 0) csi_codes[0] = 1;
-                for (int i = 0; i < csi_codes[0]; i++) {
-                    term_backward_tab();
-                }
-                state = ST_NORMAL;
-            }
-            else if (c == 'b') {
-                // REP: Repeat last graph char
-                if (arg_counter == 0) csi_codes[0] = 1;
-                state = ST_NORMAL;
-                for (int i = 0; i < csi_codes[0]; i++) {
-                    term_process_char(last_graph_char);
-                }
-            }
-            else if (c == 'r') {
-                // DECSTBM: Set Scrolling Region
-                // Scrolling is not supported, ignore
-                state = ST_NORMAL;
-            }
-            else if (c == 'h') {
-                // Mode setting
-                for (int i = 0; i < arg_counter; i++) {
-                    if (dec_set)
-                        term_dec_modeset(csi_codes[i], true);
-                    else
-                        term_modeset(csi_codes[i], true);
-                }
-                state = ST_NORMAL;
-            }
-            else if (c == 'l') {
-                // Mode setting
-                for (int i = 0; i < arg_counter; i++) {
-                    if (dec_set)
-                        term_dec_modeset(csi_codes[i], false);
-                    else
-                        term_modeset(csi_codes[i], false);
-                }
-                state = ST_NORMAL;
-            }
-            else if (c == ';') {
-                // not end yet. continue
-            }
-            else {
-                fprintf(stderr, "Unsupported CSI seq: %c (%d)", c, c);
-                state = ST_NORMAL;
-            }
+    else if (csi_codes[0] == 5) {
+        serial_puts("\e[0n"); // Ready
+    }
+    else if (csi_codes[0] == 6) {
+        term_report_cursor(dec_set);
+    }
+}
 
-            /*if (state == ST_NORMAL) {
-                printf("CSI");
-                for (int i = 0; i < arg_counter; i++) {
-                    printf("%d ", csi_codes[i]);
-                }
-                printf("%c\n", c);
-            }*/
-        }
+static void term_csi_da() {
+    // DA: Device Attributes
+    term_report_dev_attributes();
+}
+
+static void term_csi_ich() {
+    // ICH: Insert Character
+    if (arg_counter == 0) csi_codes[0] = 1;
+    term_shift_right(csi_codes[0]);
+}
+
+static void term_csi_dch() {
+    // DCH: Delete Character
+    int x = term_state_back->x;
+    int y = term_state_back->y;
+    if (arg_counter == 0) csi_codes[0] = 1;
+    int shift = csi_codes[0];
+    if (shift > (TERM_WIDTH - x))
+        shift = TERM_WIDTH - x;
+    term_move_cells(term_state_back, term_row(y), x, x + shift, TERM_WIDTH - x - shift);
+    term_fill_cells(term_state_back, term_row(y), TERM_WIDTH - shift, shift, term_blank_cell());
+    term_mark_dirty(y, x, TERM_WIDTH - 1);
+}
+
+static void term_csi_ech() {
+    // ECH: Erase Character
+    int x = term_state_back->x;
+    int y = term_state_back->y;
+    if (arg_counter == 1) {
+        int shift = csi_codes[0];
+        if (shift > (TERM_WIDTH - x))
+            shift = TERM_WIDTH - x;
+        term_erase_span(y, x, x + shift - 1);
     }
-    else if (state == ST_LSC_SEQ) {
-        // Silently ignore LSC sequence
-        state = ST_NORMAL;
-    }
-    else if (state == ST_G0S_SEQ) {
-        // Silently ignore G0 SCS
-        state = ST_NORMAL;
-    }
-    else if (state == ST_G1S_SEQ) {
-        // Silently ignore G1 SCS
-        state = ST_NORMAL;
-    }
-    else if (state == ST_OSC_SEQ) {
-        if ((c >= 0x30) && (c <= 0x39)) {
-            // reuse CSI buffer
-            csi[chr_counter++] = c;
-            if (chr_counter > 4) {
-                fprintf(stderr, "OSC sequence argument too long");
-                state = ST_NORMAL;
-            }
+}
+
+static void term_csi_su() {
+    // SU: Shift Up
+    if (arg_counter == 0) csi_codes[0] = 1;
+    term_scroll_region(csi_codes[0]);
+}
+
+static void term_csi_sd() {
+    // SD: Shift Down
+    if (arg_counter == 0) csi_codes[0] = 1;
+    term_scroll_region(-csi_codes[0]);
+}
+
+static void term_csi_cbt() {
+    // CBT
+    if (arg_counter == 0) csi_codes[0] = 1;
+    for (int i = 0; i < csi_codes[0]; i++) {
+        term_backward_tab();
+    }
+}
+
+static void term_csi_rep() {
+    // REP: Repeat last graph char
+    if (arg_counter == 0) csi_codes[0] = 1;
+    for (int i = 0; i < csi_codes[0]; i++) {
+        term_print_glyph(last_graph_char);
+    }
+}
+
+static void term_csi_decstbm() {
+    // DECSTBM: Set Scrolling Region
+    int top = ((arg_counter > 0) && (csi_codes[0] > 0)) ? csi_codes[0] : 1;
+    int bottom = ((arg_counter > 1) && (csi_codes[1] > 0)) ? csi_codes[1] :
+            TERM_HEIGHT;
+    if (bottom > TERM_HEIGHT) bottom = TERM_HEIGHT;
+    if (top >= bottom)
+        return;
+    scroll_top = top - 1;
+    scroll_bottom = bottom - 1;
+    term_cursor_set(0, 0);
+}
+
+static void term_csi_sm() {
+    // Mode setting
+    for (int i = 0; i < arg_counter; i++) {
+        if (dec_set)
+            term_dec_modeset(csi_codes[i], true);
+        else
+            term_modeset(csi_codes[i], true);
+    }
+}
+
+static void term_csi_rm() {
+    // Mode setting
+    for (int i = 0; i < arg_counter; i++) {
+        if (dec_set)
+            term_dec_modeset(csi_codes[i], false);
+        else
+            term_modeset(csi_codes[i], false);
+    }
+}
+
+typedef void (*PARSER_HANDLER)(void);
+
+// Indexed by final char
+static const PARSER_HANDLER esc_dispatch[0x80] = {
+    ['7'] = term_esc_decsc,
+    ['8'] = term_esc_decrc,
+    ['D'] = term_esc_ind,
+    ['E'] = term_esc_nel,
+    ['M'] = term_esc_ri,
+    ['Z'] = term_esc_decid,
+    ['c'] = term_esc_ris,
+    ['='] = term_esc_decpam,
+    ['>'] = term_esc_decpnm,
+};
+
+// Indexed by final char - 0x40
+#define CSI_FINAL(c) ((c) - 0x40)
+static const PARSER_HANDLER csi_dispatch[0x40] = {
+    [CSI_FINAL('@')] = term_csi_ich,
+    [CSI_FINAL('A')] = term_csi_cuu,
+    [CSI_FINAL('B')] = term_csi_cud,
+    [CSI_FINAL('C')] = term_csi_cuf,
+    [CSI_FINAL('D')] = term_csi_cub,
+    [CSI_FINAL('E')] = term_csi_cnl,
+    [CSI_FINAL('F')] = term_csi_cpl,
+    [CSI_FINAL('G')] = term_csi_cha,
+    [CSI_FINAL('H')] = term_csi_cup,
+    [CSI_FINAL('I')] = term_csi_cht,
+    [CSI_FINAL('J')] = term_csi_ed,
+    [CSI_FINAL('K')] = term_csi_el,
+    [CSI_FINAL('L')] = term_csi_il,
+    [CSI_FINAL('M')] = term_csi_dl,
+    [CSI_FINAL('P')] = term_csi_dch,
+    [CSI_FINAL('S')] = term_csi_su,
+    [CSI_FINAL('T')] = term_csi_sd,
+    [CSI_FINAL('X')] = term_csi_ech,
+    [CSI_FINAL('Z')] = term_csi_cbt,
+    [CSI_FINAL('`')] = term_csi_cha,
+    [CSI_FINAL('b')] = term_csi_rep,
+    [CSI_FINAL('c')] = term_csi_da,
+    [CSI_FINAL('d')] = term_csi_vpa,
+    [CSI_FINAL('f')] = term_csi_cup,
+    [CSI_FINAL('h')] = term_csi_sm,
+    [CSI_FINAL('l')] = term_csi_rm,
+    [CSI_FINAL('m')] = term_csi_sgr,
+    [CSI_FINAL('n')] = term_csi_dsr,
+    [CSI_FINAL('r')] = term_csi_decstbm,
+};
+
+// Parser actions, selected by the transition table
+static void term_act_none(uint8_t c) {
+}
+
+static void term_act_print(uint8_t c) {
+    term_print_glyph(charset_map[c]);
+}
+
+static void term_act_utf8_lead(uint8_t c) {
+    if (!mode_utf8) {
+        term_print_glyph(c);
+        return;
+    }
+    if ((c >= 0xc2) && (c <= 0xdf)) {
+        utf8_cp = c & 0x1f;
+        utf8_pending = 1;
+        utf8_min = 0x80;
+    }
+    else if ((c >= 0xe0) && (c <= 0xef)) {
+        utf8_cp = c & 0x0f;
+        utf8_pending = 2;
+        utf8_min = 0x800;
+    }
+    else if ((c >= 0xf0) && (c <= 0xf4)) {
+        utf8_cp = c & 0x07;
+        utf8_pending = 3;
+        utf8_min = 0x10000;
+    }
+    else {
+        // Stray continuation byte, or a lead byte UTF-8 never uses
+        term_print_glyph(UNICODE_REPLACEMENT);
+        return;
+    }
+    parser_state = ST_UTF8_SEQ;
+}
+
+static void term_act_utf8_cont(uint8_t c) {
+    utf8_cp = (utf8_cp << 6) | (c & 0x3f);
+    if (--utf8_pending)
+        return;
+    parser_state = ST_NORMAL;
+    if ((utf8_cp < utf8_min) || (utf8_cp > 0x10ffff) ||
+            ((utf8_cp >= 0xd800) && (utf8_cp <= 0xdfff)))
+        term_print_glyph(UNICODE_REPLACEMENT);
+    else
+        term_print_code_point(utf8_cp);
+}
+
+static void term_act_utf8_error(uint8_t c) {
+    // Sequence cut short, the byte that ended it is processed on its own
+    term_print_glyph(UNICODE_REPLACEMENT);
+    term_process_char(c);
+}
+
+static void term_act_docs(uint8_t c) {
+    // DOCS: Select character set, ESC % G for UTF-8 and ESC % @ for 8 bit
+    if (c == 'G')
+        mode_utf8 = true;
+    else if (c == '@')
+        mode_utf8 = false;
+    else
+        fprintf(stderr, "Unsupported DOCS: %c (%d)", c, c);
+}
+
+static void term_act_scs(int g, uint8_t c) {
+    // SCS: Select Character Set
+    if (c == 'B')
+        charset_g[g] = CHARSET_ASCII;
+    else if (c == '0')
+        charset_g[g] = CHARSET_DEC_GRAPHICS;
+    else if (c == 'A')
+        charset_g[g] = CHARSET_UK;
+    else
+        fprintf(stderr, "Unsupported SCS: %c (%d)", c, c);
+    term_charset_update();
+}
+
+static void term_act_scs_g0(uint8_t c) {
+    term_act_scs(0, c);
+}
+
+static void term_act_scs_g1(uint8_t c) {
+    term_act_scs(1, c);
+}
+
+static void term_act_si(uint8_t c) {
+    // SI: Shift In, G0 into GL
+    charset_gl = 0;
+    term_charset_update();
+}
+
+static void term_act_so(uint8_t c) {
+    // SO: Shift Out, G1 into GL
+    charset_gl = 1;
+    term_charset_update();
+}
+
+static void term_act_bs(uint8_t c) {
+    term_cursor_backward();
+}
+
+static void term_act_cr(uint8_t c) {
+    term_cursor_set(0, term_state_back->y);
+    if (mode_auto_newline)
+        term_scroll();
+}
+
+static void term_act_lf(uint8_t c) {
+    term_scroll();
+    term_cursor_set(0, term_state_back->y);
+}
+
+static void term_act_tab(uint8_t c) {
+    term_forward_tab();
+}
+
+static void term_act_iac(uint8_t c) {
+    fprintf(stderr, "IAC?\n");
+}
+
+static void term_act_esc_dispatch(uint8_t c) {
+    prof_count(PROF_ESC, 1);
+    PARSER_HANDLER handler = (c < 0x80) ? esc_dispatch[c] : NULL;
+    if (handler)
+        handler();
+    else
+        fprintf(stderr, "Unsupported escape sequence: %c (%d)", c, c);
+}
+
+static void term_act_csi_entry(uint8_t c) {
+    dec_set = false;
+    arg_counter = 0;
+    chr_counter = 0;
+}
+
+static void term_act_csi_param(uint8_t c) {
+    csi[chr_counter++] = c;
+    if (chr_counter > 4) {
+        fprintf(stderr, "CSI sequence argument too long");
+        parser_state = ST_NORMAL;
+    }
+}
+
+// Terminate the pending argument, returns false if there are too many
+static bool term_csi_end_param() {
+    csi[chr_counter] = '\0';
+    if (chr_counter != 0) {
+        csi_codes[arg_counter++] = atoi(csi);
+        chr_counter = 0;
+    }
+    if (arg_counter > 4) {
+        fprintf(stderr, "Too many arguments in one CSI sequence");
+        parser_state = ST_NORMAL;
+        return false;
+    }
+    return true;
+}
+
+static void term_act_csi_separator(uint8_t c) {
+    // not end yet. continue
+    term_csi_end_param();
+}
+
+static void term_act_csi_private(uint8_t c) {
+    if (term_csi_end_param())
+        dec_set = true;
+}
+
+static void term_act_csi_dispatch(uint8_t c) {
+    prof_count(PROF_CSI, 1);
+    if (!term_csi_end_param())
+        return;
+    PARSER_HANDLER handler = ((c >= 0x40) && (c < 0x80)) ?
+            csi_dispatch[CSI_FINAL(c)] : NULL;
+    if (handler)
+        handler();
+    else
+        fprintf(stderr, "Unsupported CSI seq: %c (%d)", c, c);
+}
+
+static void term_act_osc_entry(uint8_t c) {
+    chr_counter = 0;
+}
+
+static void term_act_osc_param(uint8_t c) {
+    // reuse CSI buffer
+    csi[chr_counter++] = c;
+    if (chr_counter > 4) {
+        fprintf(stderr, "OSC sequence argument too long");
+        parser_state = ST_NORMAL;
+    }
+}
+
+static void term_act_osc_start(uint8_t c) {
+    // Start to receive the argument
+    csi[chr_counter] = '\0';
+    osc_type = atoi(csi);
+}
+
+static void term_act_osc_end(uint8_t c) {
+    prof_count(PROF_OSC, 1);
+    if (osc_type == 0) {
+        // Set Icon and Window Title
+        // Ignore
+    }
+    else if (osc_type == 1) {
+        // Set Icon
+        // Ignore
+    }
+    else if (osc_type == 2) {
+        // Set Window Title
+        // Ignore
+    }
+    else {
+        fprintf(stderr, "Unsupported OSC seq: %d", osc_type);
+    }
+}
+
+static void term_act_osc_error(uint8_t c) {
+    fprintf(stderr, "Unexpected char in OSC: %d", c);
+}
+
+typedef enum {
+    ACT_NONE,
+    ACT_PRINT,
+    ACT_BS,
+    ACT_CR,
+    ACT_LF,
+    ACT_TAB,
+    ACT_IAC,
+    ACT_ESC_DISPATCH,
+    ACT_CSI_ENTRY,
+    ACT_CSI_PARAM,
+    ACT_CSI_SEPARATOR,
+    ACT_CSI_PRIVATE,
+    ACT_CSI_DISPATCH,
+    ACT_OSC_ENTRY,
+    ACT_OSC_PARAM,
+    ACT_OSC_START,
+    ACT_OSC_END,
+    ACT_OSC_ERROR,
+    ACT_UTF8_LEAD,
+    ACT_UTF8_CONT,
+    ACT_UTF8_ERROR,
+    ACT_DOCS,
+    ACT_SCS_G0,
+    ACT_SCS_G1,
+    ACT_SI,
+    ACT_SO,
+    ACT_COUNT
+} PARSER_ACTION;
+
+static void (*const parser_actions[ACT_COUNT])(uint8_t c) = {
+    [ACT_NONE] = term_act_none,
+    [ACT_PRINT] = term_act_print,
+    [ACT_BS] = term_act_bs,
+    [ACT_CR] = term_act_cr,
+    [ACT_LF] = term_act_lf,
+    [ACT_TAB] = term_act_tab,
+    [ACT_IAC] = term_act_iac,
+    [ACT_ESC_DISPATCH] = term_act_esc_dispatch,
+    [ACT_CSI_ENTRY] = term_act_csi_entry,
+    [ACT_CSI_PARAM] = term_act_csi_param,
+    [ACT_CSI_SEPARATOR] = term_act_csi_separator,
+    [ACT_CSI_PRIVATE] = term_act_csi_private,
+    [ACT_CSI_DISPATCH] = term_act_csi_dispatch,
+    [ACT_OSC_ENTRY] = term_act_osc_entry,
+    [ACT_OSC_PARAM] = term_act_osc_param,
+    [ACT_OSC_START] = term_act_osc_start,
+    [ACT_OSC_END] = term_act_osc_end,
+    [ACT_OSC_ERROR] = term_act_osc_error,
+    [ACT_UTF8_LEAD] = term_act_utf8_lead,
+    [ACT_UTF8_CONT] = term_act_utf8_cont,
+    [ACT_UTF8_ERROR] = term_act_utf8_error,
+    [ACT_DOCS] = term_act_docs,
+    [ACT_SCS_G0] = term_act_scs_g0,
+    [ACT_SCS_G1] = term_act_scs_g1,
+    [ACT_SI] = term_act_si,
+    [ACT_SO] = term_act_so,
+};
+
+// Byte classes, only chars that matter to any state get their own class
+typedef enum {
+    CC_GRAPH,
+    CC_BS,
+    CC_CR,
+    CC_LF,
+    CC_TAB,
+    CC_BEL,
+    CC_SO,
+    CC_SI,
+    CC_ESC,
+    CC_IAC,
+    CC_DIGIT,
+    CC_SEMICOLON,
+    CC_QUESTION,
+    CC_LBRACKET,
+    CC_RBRACKET,
+    CC_HASH,
+    CC_LPAREN,
+    CC_RPAREN,
+    CC_PERCENT,
+    CC_UTF8_CONT,
+    CC_UTF8_LEAD,
+    CC_COUNT
+} CHAR_CLASS;
+
+static const uint8_t char_class[256] = {
+    [0x07] = CC_BEL,
+    [0x08] = CC_BS,
+    [0x09] = CC_TAB,
+    [0x0a] = CC_LF,
+    [0x0b] = CC_LF,
+    [0x0c] = CC_LF,
+    [0x0d] = CC_CR,
+    [0x0e] = CC_SO,
+    [0x0f] = CC_SI,
+    [0x1b] = CC_ESC,
+    ['0'] = CC_DIGIT,
+    ['1'] = CC_DIGIT,
+    ['2'] = CC_DIGIT,
+    ['3'] = CC_DIGIT,
+    ['4'] = CC_DIGIT,
+    ['5'] = CC_DIGIT,
+    ['6'] = CC_DIGIT,
+    ['7'] = CC_DIGIT,
+    ['8'] = CC_DIGIT,
+    ['9'] = CC_DIGIT,
+    [';'] = CC_SEMICOLON,
+    ['?'] = CC_QUESTION,
+    ['['] = CC_LBRACKET,
+    [']'] = CC_RBRACKET,
+    ['#'] = CC_HASH,
+    ['('] = CC_LPAREN,
+    [')'] = CC_RPAREN,
+    ['%'] = CC_PERCENT,
+    [0x7f] = CC_BS,
+    [0x80 ... 0xbf] = CC_UTF8_CONT,
+    [0xc0 ... 0xfe] = CC_UTF8_LEAD,
+    [0xff] = CC_IAC,
+};
+
+typedef struct {
+    uint8_t action;
+    uint8_t next_state;
+} PARSER_TRANSITION;
+
+#define TR(act, st) {ACT_##act, ST_##st}
+
+// Indexed by current state and byte class. The action runs after the state
+// is updated, so actions may still override the next state.
+static const PARSER_TRANSITION parser_transitions[ST_COUNT][CC_COUNT] = {
+    [ST_NORMAL] = {
+        [0 ... CC_COUNT - 1] = TR(PRINT, NORMAL),
+        [CC_BS]         = TR(BS, NORMAL),
+        [CC_CR]         = TR(CR, NORMAL),
+        [CC_LF]         = TR(LF, NORMAL),
+        [CC_TAB]        = TR(TAB, NORMAL),
+        [CC_BEL]        = TR(NONE, NORMAL),
+        [CC_SO]         = TR(SO, NORMAL),
+        [CC_SI]         = TR(SI, NORMAL),
+        [CC_ESC]        = TR(NONE, ANSI_ESCAPE),
+        [CC_IAC]        = TR(IAC, NORMAL),
+        [CC_UTF8_CONT]  = TR(UTF8_LEAD, NORMAL),
+        [CC_UTF8_LEAD]  = TR(UTF8_LEAD, NORMAL),
+    },
+    [ST_ANSI_ESCAPE] = {
+        [0 ... CC_COUNT - 1] = TR(ESC_DISPATCH, NORMAL),
+        [CC_LBRACKET]   = TR(CSI_ENTRY, CSI_SEQ),
+        [CC_RBRACKET]   = TR(OSC_ENTRY, OSC_SEQ),
+        [CC_HASH]       = TR(NONE, LSC_SEQ),
+        [CC_LPAREN]     = TR(NONE, G0S_SEQ),
+        [CC_RPAREN]     = TR(NONE, G1S_SEQ),
+        [CC_PERCENT]    = TR(NONE, DOCS_SEQ),
+    },
+    [ST_CSI_SEQ] = {
+        [0 ... CC_COUNT - 1] = TR(CSI_DISPATCH, NORMAL),
+        [CC_DIGIT]      = TR(CSI_PARAM, CSI_SEQ),
+        [CC_SEMICOLON]  = TR(CSI_SEPARATOR, CSI_SEQ),
+        [CC_QUESTION]   = TR(CSI_PRIVATE, CSI_SEQ),
+    },
+    // Silently ignore LSC sequence
+    [ST_LSC_SEQ] = {
+        [0 ... CC_COUNT - 1] = TR(NONE, NORMAL),
+    },
+    [ST_G0S_SEQ] = {
+        [0 ... CC_COUNT - 1] = TR(SCS_G0, NORMAL),
+    },
+    [ST_G1S_SEQ] = {
+        [0 ... CC_COUNT - 1] = TR(SCS_G1, NORMAL),
+    },
+    [ST_OSC_SEQ] = {
+        [0 ... CC_COUNT - 1] = TR(OSC_ERROR, NORMAL),
+        [CC_DIGIT]      = TR(OSC_PARAM, OSC_SEQ),
+        [CC_SEMICOLON]  = TR(OSC_START, OSC_PAR),
+    },
+    [ST_OSC_PAR] = {
+        [0 ... CC_COUNT - 1] = TR(NONE, OSC_PAR),
+        [CC_BEL]        = TR(OSC_END, NORMAL),
+    },
+    [ST_DOCS_SEQ] = {
+        [0 ... CC_COUNT - 1] = TR(DOCS, NORMAL),
+    },
+    [ST_UTF8_SEQ] = {
+        [0 ... CC_COUNT - 1] = TR(UTF8_ERROR, NORMAL),
+        [CC_UTF8_CONT]  = TR(UTF8_CONT, UTF8_SEQ),
+    },
+};
+
+void term_process_char(uint8_t c) {
+    const PARSER_TRANSITION *tr = &parser_transitions[parser_state][char_class[c]];
+    parser_state = tr->next_state;
+    parser_actions[tr->action](c);
+}
+
+static bool term_is_printable(uint8_t c) {
+    return (c >= 0x20) && (c < 0x7f);
+}
+
+// Write a run of printable chars starting at the cursor. Equivalent to
+// calling term_process_char() on each of them in ST_NORMAL without insert
+// mode, but fills the row span by span instead of char by char.
+static void term_put_run(const uint8_t *str, size_t len) {
+    last_graph_char = charset_map[str[len - 1]];
+    while (len) {
+        term_cursor_check();
+        int x = term_state_back->x;
+        if ((!mode_auto_warp) && (x == TERM_WIDTH - 1)) {
+            // Without auto wrap everything lands on the last column
+            str += len - 1;
+            len = 1;
         }
-        else if (c == ';') {
-            // Start to receive the argument
-            csi[chr_counter] = '\0';
-            osc_type = atoi(csi);
-            state = ST_OSC_PAR;
+        int y = term_state_back->y;
+        int ay = term_row(y);
+        size_t span = TERM_WIDTH - x;
+        if (span > len)
+            span = len;
+#ifdef TERM_PACKED_CELLS
+        TERM_CELL attr = MAKE_CELL(0, current_flag, current_color);
+        TERM_CELL *dst = &term_state_back->cellmap[ay][x];
+        for (size_t i = 0; i < span; i++)
+            dst[i] = attr | charset_map[str[i]];
+#else
+        if (charset_ascii) {
+            memcpy(&term_state_back->textmap[ay][x], str, span);
         }
         else {
-            fprintf(stderr, "Unexpected char in OSC: %d", c);
-            state = ST_NORMAL;
+            char *dst = &term_state_back->textmap[ay][x];
+            for (size_t i = 0; i < span; i++)
+                dst[i] = charset_map[str[i]];
         }
-    }
-    else if (state == ST_OSC_PAR) {
-        if (c == 0x07) {
-            if (osc_type == 0) {
-                // Set Icon and Window Title
-                // Ignore
-            }
-            else if (osc_type == 1) {
-                // Set Icon
-                // Ignore
-            }
-            else if (osc_type == 2) {
-                // Set Window Title
-                // Ignore
-            }
-            else {
-                fprintf(stderr, "Unsupported OSC seq: %d", osc_type);
+        memset(&term_state_back->flagmap[ay][x], current_flag, span);
+        memset(&term_state_back->colormap[ay][x], current_color, span);
+#endif
+        term_mark_dirty(y, x, x + span - 1);
+        str += span;
+        len -= span;
+        x += span;
+        if (x >= TERM_WIDTH) {
+            x = TERM_WIDTH - 1;
+            if (mode_auto_warp) {
+                // only advance when the next char is entered
+                pending_wrap = true;
             }
-            state = ST_NORMAL;
         }
+        term_state_back->x = x;
     }
 }
 
-void term_process_string(char *str) {
-    while (*str) {
-        term_process_char((uint8_t)(*str++));
+void term_process_buffer(const uint8_t *buf, size_t len) {
+    uint32_t start = prof_begin();
+    prof_count(PROF_BYTES, len);
+    const uint8_t *end = buf + len;
+    while (buf < end) {
+        if ((parser_state != ST_NORMAL) || (mode_insert) ||
+                (!term_is_printable(*buf))) {
+            term_process_char(*buf++);
+            continue;
+        }
+        const uint8_t *run = buf;
+        while ((buf < end) && term_is_printable(*buf))
+            buf++;
+        term_put_run(run, buf - run);
     }
+    prof_end(PROF_PARSE, start);
+}
+
+void term_process_string(char *str) {
+    term_process_buffer((const uint8_t *)str, strlen(str));
 }
 
 void term_full_reset(void) {
     term_reset();
-    memset(&term_state_back_alternate, 0, sizeof(term_state_back_alternate));
+    term_clear_state(&term_state_back_alternate);
 }
\ No newline at end of file
@@ -21,6 +21,10 @@
 //
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
 // Platform specific definition
 
 // Additional line for scrolling
@@ -47,13 +51,130 @@
 
 #define DEFAULT_COLOR ((COLOR_WHITE << 4) | (COLOR_BLACK))
 
+// A cell value: glyph in bits 0-7, flags in bits 16-23 and color in bits
+// 24-31. Bits 8-15 are reserved for wide char and charset information.
+typedef uint32_t TERM_CELL;
+
+#define MAKE_CELL(c, flag, color) ((TERM_CELL)(uint8_t)(c) | \
+        ((TERM_CELL)(uint8_t)(flag) << 16) | ((TERM_CELL)(uint8_t)(color) << 24))
+#define CELL_GLYPH(cell) ((uint8_t)(cell))
+#define CELL_FLAG(cell) ((uint8_t)((cell) >> 16))
+#define CELL_COLOR(cell) ((uint8_t)((cell) >> 24))
+// Flags and color, cells with the same attribute render the same way
+#define CELL_ATTR(cell) ((cell) & 0xffff0000ul)
+
+// Pending row move inside a scrolling region, in buffer slots. The front end
+// applies these to the frame buffer before redrawing dirty slots.
+#define TERM_MAX_SCROLL_OPS 8
+
 typedef struct {
+    uint8_t top;    // First slot of the region, the region may wrap around
+    uint8_t height; // Number of rows in the region
+    int8_t lines;   // Rows moved up, negative moves down
+} TERM_SCROLL_OP;
+
+// Define TERM_PACKED_CELLS to store each cell as one TERM_CELL word, so that
+// compares and moves are one word op per cell. Otherwise the glyph, flags
+// and color are kept in three parallel byte maps.
+typedef struct {
+#ifdef TERM_PACKED_CELLS
+    TERM_CELL cellmap[TERM_BUF_HEIGHT][TERM_WIDTH];
+#else
     char textmap[TERM_BUF_HEIGHT][TERM_WIDTH];
     char flagmap[TERM_BUF_HEIGHT][TERM_WIDTH];
     char colormap[TERM_BUF_HEIGHT][TERM_WIDTH];
+#endif
     int x, y, y_offset;
+    // Buffer row holding each screen row. Inserting, deleting and scrolling
+    // lines only rotates this map.
+    uint8_t rowmap[TERM_BUF_HEIGHT];
+    // Damaged buffer slots, one bit per slot. Set by termcore, clear by the
+    // front end. dirty_x1/x2 are the inclusive column range on that slot.
+    uint32_t dirty_rows;
+    uint8_t dirty_x1[TERM_BUF_HEIGHT];
+    uint8_t dirty_x2[TERM_BUF_HEIGHT];
+    // Row moves done since the front end last looked, oldest first. Dirty
+    // slots are moved along with the rows.
+    TERM_SCROLL_OP scroll_ops[TERM_MAX_SCROLL_OPS];
+    int scroll_op_count;
 } TERM_STATE;
 
+// Cell access, y is the buffer row
+static inline TERM_CELL term_get_cell(const TERM_STATE *state, int y, int x) {
+#ifdef TERM_PACKED_CELLS
+    return state->cellmap[y][x];
+#else
+    return MAKE_CELL(state->textmap[y][x], state->flagmap[y][x],
+            state->colormap[y][x]);
+#endif
+}
+
+static inline void term_set_cell(TERM_STATE *state, int y, int x, TERM_CELL cell) {
+#ifdef TERM_PACKED_CELLS
+    state->cellmap[y][x] = cell;
+#else
+    state->textmap[y][x] = CELL_GLYPH(cell);
+    state->flagmap[y][x] = CELL_FLAG(cell);
+    state->colormap[y][x] = CELL_COLOR(cell);
+#endif
+}
+
+static inline void term_fill_cells(TERM_STATE *state, int y, int x, int n,
+        TERM_CELL cell) {
+#ifdef TERM_PACKED_CELLS
+    TERM_CELL *dst = &state->cellmap[y][x];
+    while (n--)
+        *dst++ = cell;
+#else
+    memset(&state->textmap[y][x], CELL_GLYPH(cell), n);
+    memset(&state->flagmap[y][x], CELL_FLAG(cell), n);
+    memset(&state->colormap[y][x], CELL_COLOR(cell), n);
+#endif
+}
+
+// Move n cells within a row, ranges may overlap
+static inline void term_move_cells(TERM_STATE *state, int y, int dst_x,
+        int src_x, int n) {
+#ifdef TERM_PACKED_CELLS
+    memmove(&state->cellmap[y][dst_x], &state->cellmap[y][src_x],
+            n * sizeof(TERM_CELL));
+#else
+    memmove(&state->textmap[y][dst_x], &state->textmap[y][src_x], n);
+    memmove(&state->flagmap[y][dst_x], &state->flagmap[y][src_x], n);
+    memmove(&state->colormap[y][dst_x], &state->colormap[y][src_x], n);
+#endif
+}
+
+// Copy n cells starting at x from row src_y of src to row dst_y of dst
+static inline void term_copy_cells(TERM_STATE *dst, int dst_y,
+        const TERM_STATE *src, int src_y, int x, int n) {
+#ifdef TERM_PACKED_CELLS
+    memcpy(&dst->cellmap[dst_y][x], &src->cellmap[src_y][x],
+            n * sizeof(TERM_CELL));
+#else
+    memcpy(&dst->textmap[dst_y][x], &src->textmap[src_y][x], n);
+    memcpy(&dst->flagmap[dst_y][x], &src->flagmap[src_y][x], n);
+    memcpy(&dst->colormap[dst_y][x], &src->colormap[src_y][x], n);
+#endif
+}
+
+static inline void term_copy_row(TERM_STATE *state, int dst_y, int src_y) {
+#ifdef TERM_PACKED_CELLS
+    memcpy(state->cellmap[dst_y], state->cellmap[src_y], sizeof(state->cellmap[0]));
+#else
+    memcpy(state->textmap[dst_y], state->textmap[src_y], TERM_WIDTH);
+    memcpy(state->flagmap[dst_y], state->flagmap[src_y], TERM_WIDTH);
+    memcpy(state->colormap[dst_y], state->colormap[src_y], TERM_WIDTH);
+#endif
+}
+
+// Buffer row shown in buffer slot s. Screen row y sits in slot y + y_offset.
+static inline int term_slot_row(const TERM_STATE *state, int s) {
+    int y = s - state->y_offset;
+    if (y < 0) y += TERM_BUF_HEIGHT;
+    return state->rowmap[y];
+}
+
 extern TERM_STATE *term_state_back; // State front is provided in the front end
 extern bool term_state_dirty; // Set by termcore, clear by the front end
 
@@ -62,10 +183,14 @@ extern bool mode_app_keypad;
 extern bool mode_app_cursor;
 extern bool mode_cursor_blinking;
 extern bool mode_show_cursor;
+extern bool mode_synchronized_update;
 
 // Needs to be implemented by user:
 extern void serial_puts(char *string);
 
 void term_full_reset(void);
+// Mark every buffer slot of state to be redrawn
+void term_invalidate(TERM_STATE *state);
 void term_process_char(uint8_t c);
+void term_process_buffer(const uint8_t *buf, size_t len);
 void term_process_string(char *str);
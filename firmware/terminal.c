@@ -25,6 +25,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include "pico/stdlib.h"
+#ifdef TERM_DUAL_CORE
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+#endif
 #include "el.h"
 #include "graphics.h"
 #include "terminal.h"
@@ -32,12 +36,54 @@
 #include "tusb.h"
 #include "usbhid.h"
 #include "termcore.h"
+#include "setup.h"
+#include "scrollback.h"
+#include "search.h"
+#include "prof.h"
 
 #define MAX_DEBUG_LEN 107
 char debugmsg[MAX_DEBUG_LEN];
 
 static TERM_STATE term_state_front_main;
 static TERM_STATE *term_state_front = &term_state_front_main;
+// Back buffer damage taken for drawing, in frame buffer order like the front
+static TERM_STATE term_state_snap;
+// Scrollback view: number of history lines the screen is scrolled back by,
+// the view is drawn into its own state so the live screen keeps updating
+static volatile int term_view_offset = 0;
+static TERM_STATE term_state_view;
+// Profiling overlay on the bottom line, toggled with Ctrl+F10
+static volatile bool term_prof_overlay = false;
+
+// Search mode shows the view with the pattern on a prompt line
+static volatile bool term_search_active = false;
+static char term_search_pattern[SEARCH_MAX_LEN];
+static int term_search_len;
+
+static inline bool term_view_shown() {
+    return term_view_offset || term_search_active;
+}
+
+#ifdef TERM_DUAL_CORE
+// Core 0 runs termcore, core 1 draws. The back buffer is only touched with
+// this lock held. No interrupt handler takes it, so interrupts stay on while
+// it is held: a parse chunk can take long, and the panel refresh, the flow
+// control timer and USB must keep running meanwhile.
+static spin_lock_t *term_spin_lock;
+
+static inline void term_lock() {
+    spin_lock_unsafe_blocking(term_spin_lock);
+}
+
+static inline void term_unlock() {
+    spin_unlock_unsafe(term_spin_lock);
+}
+
+static void term_render_core();
+#else
+static inline void term_lock() {}
+static inline void term_unlock() {}
+#endif
 
 //Keyboard states
 #define MAX_PRESSED_KEYS (6) // Limited by HID
@@ -47,9 +93,18 @@ static uint32_t key_pressed_since[6] = {0};
 static bool key_is_shift = false;
 static bool key_is_ctrl = false;
 
-#define MAX_UPDATE (80 * 10)
+// Time one screen update may take before it returns, the rest is drawn on
+// the next pass
+#ifndef TERM_UPDATE_BUDGET_US
+#define TERM_UPDATE_BUDGET_US (2000)
+#endif
+// Longest time a synchronized update may hold the screen
+#ifndef TERM_SYNC_TIMEOUT_US
+#define TERM_SYNC_TIMEOUT_US (200000)
+#endif
 
 static volatile bool timer_pending = false;
+static volatile bool blink_pending = false;
 
 static bool cursor_state = false;
 
@@ -57,15 +112,19 @@ void term_clear_cursor() {
     int x = term_state_front->x;
     int y = term_state_front->y + term_state_front->y_offset;
     if (y >= TERM_BUF_HEIGHT) y -= TERM_BUF_HEIGHT;
-    char text = term_state_front->textmap[y][x];
-    char color = term_state_front->colormap[y][x];
+    TERM_CELL cell = term_get_cell(term_state_front, y, x);
+    char color = CELL_COLOR(cell);
     char fg = (uint8_t)color >> 4;
     char bg = color & 0xf;
-    char flag = term_state_front->flagmap[y][x];
-    graph_put_char(x * 8, y * 16, text, fg, bg, flag);
+    graph_put_char(x * 8, y * 16, CELL_GLYPH(cell), fg, bg, CELL_FLAG(cell));
 }
 
 void term_disp_cursor() {
+    if (term_view_shown()) {
+        // No cursor on history
+        term_clear_cursor();
+        return;
+    }
     int x = term_state_front->x;
     int y = term_state_front->y + term_state_front->y_offset;
     if (y >= TERM_BUF_HEIGHT) y -= TERM_BUF_HEIGHT;
@@ -82,7 +141,15 @@ void term_update_cursor() {
 }
 
 bool term_timer_callback(struct repeating_timer *t) {
+    static int timer_div = 0;
+    // Timer interval: 100ms
     timer_pending = true;
+    timer_div++;
+    if (timer_div == 5) {
+        // Cursor update every 500ms
+        blink_pending = true;
+        timer_div = 0;
+    }
     return true;
 }
 
@@ -187,8 +254,191 @@ bool term_decode_special_keymode(uint8_t keycode, bool is_shift, bool is_ctrl) {
     return false;
 }
 
+static void term_invert_cells(TERM_STATE *state, int y, int x, int n) {
+    for (; (n > 0) && (x < TERM_WIDTH); n--, x++) {
+        TERM_CELL cell = term_get_cell(state, y, x);
+        term_set_cell(state, y, x, MAKE_CELL(CELL_GLYPH(cell),
+                CELL_FLAG(cell) ^ FLAG_INVERT, CELL_COLOR(cell)));
+    }
+}
+
+// Highlight the match on the view and put the prompt on the bottom line,
+// or the top line when the match is at the bottom
+static void term_search_draw(TERM_STATE *view, int offset) {
+    int hit_y = -1;
+    if (search_status() == SEARCH_FOUND) {
+        const SEARCH_HIT *hit = search_hit();
+        if (hit->history)
+            hit_y = offset - 1 - (int)(scrollback_next() - 1 - hit->line);
+        else
+            hit_y = hit->line + offset;
+        if ((hit_y >= 0) && (hit_y < TERM_HEIGHT))
+            term_invert_cells(view, view->rowmap[hit_y], hit->x, hit->len);
+    }
+
+    char prompt[TERM_WIDTH + 1];
+    const char *status = "";
+    if (search_status() == SEARCH_RUNNING)
+        status = " ...";
+    else if (search_status() == SEARCH_NOT_FOUND)
+        status = " (not found)";
+    int len = snprintf(prompt, sizeof(prompt), "Search: %.*s%s",
+            term_search_len, term_search_pattern, status);
+    if (len > TERM_WIDTH)
+        len = TERM_WIDTH;
+    int row = view->rowmap[(hit_y == TERM_HEIGHT - 1) ? 0 : TERM_HEIGHT - 1];
+    for (int x = 0; x < TERM_WIDTH; x++) {
+        term_set_cell(view, row, x, MAKE_CELL((x < len) ? prompt[x] : ' ',
+                FLAG_INVERT, DEFAULT_COLOR));
+    }
+}
+
+// Fill the view with the screen scrolled back by term_view_offset lines,
+// using the same slot layout as the live screen
+static void term_view_draw() {
+    TERM_STATE *live = term_state_back;
+    TERM_STATE *view = &term_state_view;
+    int offset = term_view_offset;
+
+    view->y_offset = live->y_offset;
+    for (int y = 0; y < TERM_BUF_HEIGHT; y++)
+        view->rowmap[y] = (y + live->y_offset) % TERM_BUF_HEIGHT;
+    for (int y = 0; y < TERM_HEIGHT; y++) {
+        int row = view->rowmap[y];
+        if (y < offset)
+            scrollback_get_line(offset - 1 - y, view, row);
+        else
+            term_copy_cells(view, row, live, live->rowmap[y - offset], 0,
+                    TERM_WIDTH);
+    }
+    view->x = live->x;
+    view->y = live->y;
+    if (term_search_active)
+        term_search_draw(view, offset);
+    term_invalidate(view);
+}
+
+// Scroll the view by delta lines, positive goes back in history
+static void term_view_scroll(int delta) {
+    int offset = term_view_offset + delta;
+    int lines = scrollback_lines();
+    if (offset > lines) offset = lines;
+    if (offset < 0) offset = 0;
+    if (offset == term_view_offset)
+        return;
+    term_view_offset = offset;
+    if (term_view_shown())
+        term_view_draw();
+    else
+        term_invalidate(term_state_back);
+}
+
+// Back to the live screen
+static void term_view_exit() {
+    search_stop();
+    term_search_active = false;
+    term_view_offset = 0;
+    term_invalidate(term_state_back);
+}
+
+// Scroll the view to show the match, if there is one
+static void term_search_show() {
+    if (search_status() == SEARCH_FOUND) {
+        const SEARCH_HIT *hit = search_hit();
+        int offset = 0;
+        if (hit->history) {
+            // Put the line in the middle of the screen where possible
+            offset = (scrollback_next() - 1 - hit->line) + 1 + TERM_HEIGHT / 2;
+            if (offset > scrollback_lines())
+                offset = scrollback_lines();
+        }
+        term_view_offset = offset;
+    }
+    term_view_draw();
+}
+
+// Ctrl+F11 starts a search. Typing edits the pattern, Enter finds the next
+// match further back and Esc returns to the live screen.
+static void term_search_key(uint8_t keycode, bool is_shift, bool is_ctrl) {
+    if (!term_search_active) {
+        term_search_active = true;
+        term_search_len = 0;
+    }
+    else if (keycode == HID_KEY_ESCAPE) {
+        term_view_exit();
+        return;
+    }
+    else if (keycode == HID_KEY_ENTER) {
+        search_next();
+        term_view_draw();
+        return;
+    }
+    else if (keycode == HID_KEY_BACKSPACE) {
+        if (term_search_len > 0)
+            term_search_len--;
+    }
+    else {
+        uint8_t ch = 0;
+        if (!is_ctrl && (keycode < 128))
+            ch = keycode2ascii[keycode][is_shift ? 1 : 0];
+        if ((ch < 0x20) || (ch >= 0x7f) || (term_search_len == SEARCH_MAX_LEN))
+            return;
+        term_search_pattern[term_search_len++] = ch;
+    }
+    search_start(term_search_pattern, term_search_len);
+    term_view_draw();
+}
+
 void term_key_sendcode(uint8_t keycode, bool is_shift, bool is_ctrl) {
     uint8_t ch;
+    if (is_ctrl && (keycode == HID_KEY_F10)) {
+        term_lock();
+        term_prof_overlay = !term_prof_overlay;
+        if (!term_prof_overlay) {
+            // Redraw what the overlay covered
+            term_invalidate(term_view_shown() ? &term_state_view :
+                    term_state_back);
+        }
+        term_unlock();
+        return;
+    }
+    if (!setup_is_active()) {
+        // Shift+PgUp/PgDn page through history, any other key returns to
+        // the live screen
+        if (is_shift && ((keycode == HID_KEY_PAGE_UP) ||
+                (keycode == HID_KEY_PAGE_DOWN))) {
+            term_lock();
+            term_view_scroll((keycode == HID_KEY_PAGE_UP) ?
+                    (TERM_HEIGHT - 1) : -(TERM_HEIGHT - 1));
+            term_unlock();
+            return;
+        }
+        if (term_search_active || (is_ctrl && (keycode == HID_KEY_F11))) {
+            term_lock();
+            term_search_key(keycode, is_shift, is_ctrl);
+            term_unlock();
+            return;
+        }
+        if (term_view_offset) {
+            term_lock();
+            term_view_exit();
+            term_unlock();
+        }
+    }
+    if (setup_is_active() || (is_ctrl && (keycode == HID_KEY_F12))) {
+        // Setup screen takes over the back buffer
+        term_lock();
+        if (setup_is_active()) {
+            setup_key(keycode);
+        }
+        else {
+            if (term_view_shown())
+                term_view_exit();
+            setup_open();
+        }
+        term_unlock();
+        return;
+    }
     if (term_decode_special_keymode(keycode, is_shift, is_ctrl))
         return;
 
@@ -290,49 +540,224 @@ void term_key_released(uint8_t keycode) {
     }
 }
 
-void term_update_screen() {
-    // This function compares front buffer and back buffer for the difference.
-    // It updates at most MAX_UPDATE char at a time and return.
-    int update_count = 0;
-
-    for (int y = 0; y < TERM_BUF_HEIGHT; y++) {
-        for (int x = 0; x < TERM_WIDTH; x++) {
-            char text = term_state_back->textmap[y][x];
-            char color = term_state_back->colormap[y][x];
-            char flag = term_state_back->flagmap[y][x];
-
-            if ((term_state_front->textmap[y][x] != text) ||
-                    (term_state_front->colormap[y][x] != color) ||
-                    (term_state_front->flagmap[y][x] != flag)) {
-                // Diff found
-                term_state_front->textmap[y][x] = text;
-                term_state_front->colormap[y][x] = color;
-                term_state_front->flagmap[y][x] = flag;
-                char fg = (uint8_t)color >> 4;
-                char bg = color & 0xf;
-                graph_put_char(x * 8, y * 16, text, fg, bg, flag);
-                update_count ++;
-                if (update_count > MAX_UPDATE)
-                    return;
+// A run of blank glyphs without line decorations draws nothing but background
+static bool term_run_is_blank(const char *glyphs, int n, TERM_CELL attr) {
+    if (CELL_FLAG(attr) & (FLAG_UNDERLINE | FLAG_STHROUGH))
+        return false;
+    for (int i = 0; i < n; i++) {
+        if ((glyphs[i] != ' ') && (glyphs[i] != 0))
+            return false;
+    }
+    return true;
+}
+
+static void term_draw_run(int x, int y, const char *glyphs, int n,
+        TERM_CELL attr) {
+    uint32_t start = prof_begin();
+    char color = CELL_COLOR(attr);
+    char fg = (uint8_t)color >> 4;
+    char bg = color & 0xf;
+    if (term_run_is_blank(glyphs, n, attr)) {
+        // Erased cells are only background, fill them as one rectangle
+        char c = (CELL_FLAG(attr) & FLAG_INVERT) ? fg : bg;
+        graph_fill_rect(x * 8, y * 16, (x + n) * 8, (y + 1) * 16, c);
+    }
+    else {
+        graph_put_text_run(x * 8, y * 16, glyphs, n, fg, bg, CELL_FLAG(attr));
+    }
+    prof_count(PROF_CELLS_DRAWN, n);
+    prof_end(PROF_DRAW, start);
+}
+
+static void term_move_row(int dst, int src) {
+    term_copy_row(term_state_front, dst, src);
+    graph_copy_lines(dst * 16, src * 16, 16);
+}
+
+// Call move() for each row a scroll op moves, in an order that reads every
+// row before it is overwritten
+static void term_scroll_op_rows(const TERM_SCROLL_OP *op,
+        void (*move)(int dst, int src)) {
+    int lines = op->lines;
+    if (lines > 0) {
+        for (int y = 0; y < op->height - lines; y++) {
+            move((op->top + y) % TERM_BUF_HEIGHT,
+                    (op->top + y + lines) % TERM_BUF_HEIGHT);
+        }
+    }
+    else {
+        for (int y = op->height - 1; y >= -lines; y--) {
+            move((op->top + y) % TERM_BUF_HEIGHT,
+                    (op->top + y + lines) % TERM_BUF_HEIGHT);
+        }
+    }
+}
+
+// Replay the row moves logged by termcore on the frame buffer and the front
+// buffer, so scrolled rows don't need to be redrawn
+static void term_apply_scroll_ops() {
+    int count = term_state_snap.scroll_op_count;
+    if (count == 0)
+        return;
+    uint32_t start = prof_begin();
+    term_clear_cursor();
+    for (int i = 0; i < count; i++)
+        term_scroll_op_rows(&term_state_snap.scroll_ops[i], term_move_row);
+    term_state_snap.scroll_op_count = 0;
+    term_update_cursor();
+    prof_end(PROF_SCROLL, start);
+}
+
+// Rows of the snapshot not drawn yet move along with the rows of the back
+// buffer, dirty span included
+static void term_snap_move_row(int dst, int src) {
+    TERM_STATE *snap = &term_state_snap;
+    term_copy_row(snap, dst, src);
+    if (snap->dirty_rows & (1ul << src)) {
+        snap->dirty_rows |= 1ul << dst;
+        snap->dirty_x1[dst] = snap->dirty_x1[src];
+        snap->dirty_x2[dst] = snap->dirty_x2[src];
+    }
+    else {
+        snap->dirty_rows &= ~(1ul << dst);
+    }
+}
+
+// Rows damaged by the last term_take_damage(), drawn before older ones
+static uint32_t term_recent_rows;
+
+// Move the damage done to the back buffer since the last call into the
+// snapshot: the dirty cells, the row moves and the cursor. Damage not drawn
+// yet is kept, with the row moves applied to it. This is the only place the
+// renderer looks at the back buffer.
+static void term_take_damage() {
+    TERM_STATE *snap = &term_state_snap;
+
+    term_lock();
+    TERM_STATE *back = term_view_shown() ? &term_state_view : term_state_back;
+    for (int i = 0; i < back->scroll_op_count; i++) {
+        const TERM_SCROLL_OP *op = &back->scroll_ops[i];
+        term_scroll_op_rows(op, term_snap_move_row);
+        // Rows scrolled in are marked dirty in whole on the back buffer
+        int lines = (op->lines > 0) ? op->lines : -op->lines;
+        int vacated = (op->lines > 0) ? (op->height - lines) : 0;
+        for (int y = vacated; y < vacated + lines; y++)
+            snap->dirty_rows &= ~(1ul << ((op->top + y) % TERM_BUF_HEIGHT));
+    }
+    memcpy(snap->scroll_ops, back->scroll_ops,
+            back->scroll_op_count * sizeof(TERM_SCROLL_OP));
+    snap->scroll_op_count = back->scroll_op_count;
+    back->scroll_op_count = 0;
+    uint32_t rows = back->dirty_rows;
+    term_recent_rows = rows;
+    while (rows) {
+        int y = __builtin_ctz(rows);
+        rows &= rows - 1;
+        int x1 = back->dirty_x1[y];
+        int x2 = back->dirty_x2[y];
+        term_copy_cells(snap, y, back, term_slot_row(back, y), x1, x2 - x1 + 1);
+        if (snap->dirty_rows & (1ul << y)) {
+            if (x1 > snap->dirty_x1[y]) x1 = snap->dirty_x1[y];
+            if (x2 < snap->dirty_x2[y]) x2 = snap->dirty_x2[y];
+        }
+        snap->dirty_x1[y] = x1;
+        snap->dirty_x2[y] = x2;
+    }
+    snap->dirty_rows |= back->dirty_rows;
+    back->dirty_rows = 0;
+    snap->x = back->x;
+    snap->y = back->y;
+    snap->y_offset = back->y_offset;
+    term_state_dirty = false;
+    term_unlock();
+}
+
+// Diff row y of the snapshot against the front buffer and draw what changed
+static void term_draw_row(int y) {
+    int x2 = term_state_snap.dirty_x2[y];
+    prof_count(PROF_CELLS_DIFFED, x2 - term_state_snap.dirty_x1[y] + 1);
+    // Changed cells next to each other with the same attribute are drawn as
+    // one run
+    char run[TERM_WIDTH];
+    int run_x = 0;
+    int run_len = 0;
+    TERM_CELL run_attr = 0;
+    for (int x = term_state_snap.dirty_x1[y]; x <= x2; x++) {
+        TERM_CELL cell = term_get_cell(&term_state_snap, y, x);
+
+        if (term_get_cell(term_state_front, y, x) != cell) {
+            // Diff found
+            term_set_cell(term_state_front, y, x, cell);
+            if (run_len && ((CELL_ATTR(cell) != run_attr) ||
+                    (x != run_x + run_len))) {
+                term_draw_run(run_x, y, run, run_len, run_attr);
+                run_len = 0;
+            }
+            if (run_len == 0) {
+                run_x = x;
+                run_attr = CELL_ATTR(cell);
             }
+            run[run_len++] = CELL_GLYPH(cell);
         }
     }
+    if (run_len)
+        term_draw_run(run_x, y, run, run_len, run_attr);
+    term_state_snap.dirty_rows &= ~(1ul << y);
+}
 
-    if ((term_state_back->x != term_state_front->x) || 
-            (term_state_back->y != term_state_front->y)) {
-        term_clear_cursor();
-        term_state_front->x = term_state_back->x;
-        term_state_front->y = term_state_back->y;
-        term_disp_cursor();
+static bool term_draw_damage(bool take) {
+    // This function compares front buffer and the snapshot of the back
+    // buffer for the difference on rows that termcore marked dirty. Rows
+    // are drawn until TERM_UPDATE_BUDGET_US is used up, the cursor row
+    // first, then the rows damaged most recently, then the rest. New
+    // damage is only taken when take is set. Returns true when there is
+    // more of the snapshot left to draw.
+    uint32_t start = time_us_32();
+
+    if (take)
+        term_take_damage();
+    term_apply_scroll_ops();
+
+    // Both the snapshot and the front buffer are in frame buffer order
+    int cursor_row = (term_state_snap.y + term_state_snap.y_offset) %
+            TERM_BUF_HEIGHT;
+    while (term_state_snap.dirty_rows) {
+        uint32_t rows = term_state_snap.dirty_rows;
+        int y;
+        if (rows & (1ul << cursor_row))
+            y = cursor_row;
+        else if (rows & term_recent_rows)
+            y = __builtin_ctz(rows & term_recent_rows);
+        else
+            y = __builtin_ctz(rows);
+        term_draw_row(y);
+        if ((time_us_32() - start) >= TERM_UPDATE_BUDGET_US)
+            break;
     }
 
-    if (term_state_back->y_offset != term_state_front->y_offset) {
+    // The cursor is shown again after a scroll as well as after a move
+    if ((term_state_snap.x != term_state_front->x) ||
+            (term_state_snap.y != term_state_front->y) ||
+            (term_state_snap.y_offset != term_state_front->y_offset)) {
         term_clear_cursor();
-        term_state_front->y_offset = term_state_back->y_offset;
+        term_state_front->x = term_state_snap.x;
+        term_state_front->y = term_state_snap.y;
+        term_state_front->y_offset = term_state_snap.y_offset;
         //frame_scroll_lines = term_state_front->y_offset * 16;
+        term_disp_cursor();
     }
+    return (term_state_snap.dirty_rows != 0);
+}
 
-    term_state_dirty = false;
+static bool term_update(bool take) {
+    uint32_t start = prof_begin();
+    bool more = term_draw_damage(take);
+    prof_end(PROF_UPDATE, start);
+    return more;
+}
+
+bool term_update_screen() {
+    return term_update(true);
 }
 
 int term_printf(const char *format, ...) {
@@ -347,7 +772,9 @@ int term_printf(const char *format, ...) {
 
     va_end(ap);
 
+    term_lock();
     term_process_string(printf_buffer);
+    term_unlock();
 
     return length;
 }
@@ -364,6 +791,10 @@ void term_init() {
     memset(term_state_front, 0, sizeof(*term_state_front));
 
     term_process_string("ELTerm 0.01\r\n");
+#ifdef TERM_DUAL_CORE
+    term_spin_lock = spin_lock_init(spin_lock_claim_unused(true));
+    multicore_launch_core1(term_render_core);
+#endif
 #if 0
     uint64_t timediff = time_us_64();
     char fg = 1;
@@ -399,43 +830,91 @@ void term_init() {
 #endif
 }
 
-void term_loop() {
-    static int timer_div = 0;
-    char c;
-
-    // Process timing related work
-    if (timer_pending) {
-        // Timer interval: 100ms
-        timer_pending = false;
-
-        timer_div++;
-        if (timer_div == 5) {
-            // Cursor update every 500ms
-            cursor_state = !cursor_state;
-            term_update_cursor();
-            gpio_put(25, cursor_state);
-            timer_div = 0;
-        }
-
-        // Key repeat
-        for (int i = 0; i < MAX_PRESSED_KEYS; i++) {
-            if ((key_pressed_code[i] != 0) &&
-                    ((time_us_32() - key_pressed_since[i]) > 1000000)) {
-                term_key_sendcode(key_pressed_code[i], key_is_shift, key_is_ctrl);
-            }
-        }
-        
+// Draw the share of time spent in each phase and the rates since the last
+// call over the bottom line. The front buffer gets the overlay cells, so
+// the line is redrawn as usual once the overlay is turned off.
+static void term_prof_draw() {
+    static uint32_t last_time;
+    static uint32_t last_us[PROF_PHASE_COUNT];
+    static uint32_t last_bytes;
+    static uint32_t last_drawn;
+    uint32_t now = time_us_32();
+    uint32_t elapsed = now - last_time;
+    if (elapsed == 0)
+        return;
+    unsigned int percent[PROF_PHASE_COUNT];
+    for (int i = 0; i < PROF_PHASE_COUNT; i++) {
+        uint32_t us = prof_phase_us(i);
+        percent[i] = (uint64_t)(us - last_us[i]) * 100 / elapsed;
+        last_us[i] = us;
+    }
+    uint32_t bytes = prof_data.counters[PROF_BYTES];
+    uint32_t drawn = prof_data.counters[PROF_CELLS_DRAWN];
+    char line[TERM_WIDTH + 1];
+    int len = snprintf(line, sizeof(line),
+            "parse %2u%% upd %2u%% draw %2u%% scrl %2u%%  %7lu B/s  "
+            "%7lu cells/s  drop %lu", percent[PROF_PARSE],
+            percent[PROF_UPDATE], percent[PROF_DRAW], percent[PROF_SCROLL],
+            (unsigned long)((uint64_t)(bytes - last_bytes) * 1000000 / elapsed),
+            (unsigned long)((uint64_t)(drawn - last_drawn) * 1000000 / elapsed),
+            (unsigned long)prof_data.counters[PROF_RX_DROPPED]);
+    if (len > TERM_WIDTH)
+        len = TERM_WIDTH;
+    memset(line + len, ' ', TERM_WIDTH - len);
+    last_time = now;
+    last_bytes = bytes;
+    last_drawn = drawn;
+
+    int y = (TERM_HEIGHT - 1 + term_state_front->y_offset) % TERM_BUF_HEIGHT;
+    char fg = (uint8_t)DEFAULT_COLOR >> 4;
+    char bg = DEFAULT_COLOR & 0xf;
+    graph_put_text_run(0, y * 16, line, TERM_WIDTH, fg, bg, FLAG_INVERT);
+    for (int x = 0; x < TERM_WIDTH; x++) {
+        term_set_cell(term_state_front, y, x,
+                MAKE_CELL(line[x], FLAG_INVERT, DEFAULT_COLOR));
     }
-    // Process all chars in the FIFO
-    while (serial_getc(&c)) {
-        term_process_char(c);
+}
+
+// While the host has synchronized update mode set, new damage is held back
+// until it is reset or TERM_SYNC_TIMEOUT_US has passed
+static bool term_sync_hold() {
+    static bool held = false;
+    static uint32_t held_since;
+    if (!mode_synchronized_update) {
+        held = false;
+        return false;
     }
-    // Update up to one char on screen
-    if (term_state_dirty) {
-        term_update_screen();
+    if (!held) {
+        held = true;
+        held_since = time_us_32();
     }
+    return (time_us_32() - held_since) < TERM_SYNC_TIMEOUT_US;
+}
+
+// Drawing side of the terminal: screen updates, cursor blink and smooth
+// scrolling
+static void term_render() {
+    if (blink_pending) {
+        blink_pending = false;
+        cursor_state = !cursor_state;
+        term_update_cursor();
+        gpio_put(25, cursor_state);
+        if (term_prof_overlay)
+            term_prof_draw();
+    }
+    bool new_frame = false;
     if (frame_sync) {
         frame_sync = false;
+        new_frame = true;
+    }
+    // Damage is taken once per panel frame, so everything parsed in between
+    // goes out in one go. What the time budget leaves over is drawn until
+    // the next frame.
+    if (new_frame && term_state_dirty && !term_sync_hold())
+        term_update(true);
+    else if (term_state_snap.dirty_rows)
+        term_update(false);
+    if (new_frame) {
         // Smooth scrolling
         uint32_t cur_scroll_lines = frame_scroll_lines;
         uint32_t new_scroll_lines;
@@ -462,6 +941,67 @@ void term_loop() {
             frame_scroll_lines = new_scroll_lines;
         }
     }
+}
+
+#ifdef TERM_DUAL_CORE
+static void term_render_core() {
+    // Saving settings stops this core while flash is written
+    multicore_lockout_victim_init();
+    prof_init();
+    while (1) {
+        term_render();
+    }
+}
+#endif
+
+// Ctrl+F10, F11 and F12 switch modes, they act on the initial press only
+static bool term_key_is_toggle(uint8_t keycode, bool is_ctrl) {
+    return is_ctrl && ((keycode == HID_KEY_F10) || (keycode == HID_KEY_F11) ||
+            (keycode == HID_KEY_F12));
+}
+
+void term_loop() {
+    uint8_t buf[64];
+    size_t len;
+
+    // Process timing related work
+    if (timer_pending) {
+        timer_pending = false;
+
+        // Key repeat
+        for (int i = 0; i < MAX_PRESSED_KEYS; i++) {
+            if ((key_pressed_code[i] != 0) &&
+                    !term_key_is_toggle(key_pressed_code[i], key_is_ctrl) &&
+                    ((time_us_32() - key_pressed_since[i]) > 1000000)) {
+                term_key_sendcode(key_pressed_code[i], key_is_shift, key_is_ctrl);
+            }
+        }
+        
+    }
+    setup_poll();
+    // Process all chars in the FIFO, in chunks. Received data waits while
+    // the setup screen is open.
+    while (!setup_is_active()) {
+        len = serial_read(buf, sizeof(buf));
+        // Nothing to parse, leave the lock to the renderer
+        if (len == 0)
+            break;
+        term_lock();
+        term_process_buffer(buf, len);
+        term_unlock();
+        if (len != sizeof(buf))
+            break;
+    }
+    // Search a few lines further each time round
+    if (search_status() == SEARCH_RUNNING) {
+        term_lock();
+        if (search_step(term_state_back) != SEARCH_RUNNING)
+            term_search_show();
+        term_unlock();
+    }
+#ifndef TERM_DUAL_CORE
+    term_render();
+#endif
     // Poll USB
     usbhid_polling();
 }
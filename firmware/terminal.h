@@ -23,6 +23,8 @@
 
 void term_init();
 void term_loop();
+// Draw part of the pending damage, returns true when there is more left
+bool term_update_screen();
 // Print from internal
 int term_printf(const char *format, ...);
 // Handle key input from keyboard
@@ -71,3 +71,51 @@ TEST_VECTOR test_esc_decscrc = {
     .expected_cursor_x = 13,
     .expected_cursor_y = 0
 };
+
+TEST_VECTOR test_esc_scs = {
+    .name = "esc scs",
+    .input_sequence = "\e(0lqqk\e(B lqk \e(A#",
+    .expected_screen = {
+        "\xda\xc4\xc4\xbf lqk \x9c",
+        0
+    },  
+    .expected_serial = "",
+    .expected_cursor_x = 10,
+    .expected_cursor_y = 0
+};
+
+TEST_VECTOR test_esc_shift = {
+    .name = "esc si/so",
+    .input_sequence = "\e)0a\x0eqx\x0fq\x0e\e7\x0f\e8x",
+    .expected_screen = {
+        "a\xc4\xb3q\xb3",
+        0
+    },  
+    .expected_serial = "",
+    .expected_cursor_x = 5,
+    .expected_cursor_y = 0
+};
+
+TEST_VECTOR test_esc_cha_range = {
+    .name = "esc cha out of range",
+    .input_sequence = "abc\e[0GX\e[200G\bY",
+    .expected_screen = {
+        "Xbc                                                                           Y",
+        0
+    },  
+    .expected_serial = "",
+    .expected_cursor_x = 79,
+    .expected_cursor_y = 0
+};
+
+TEST_VECTOR test_esc_vpa_range = {
+    .name = "esc vpa out of range",
+    .input_sequence = "\e[200dA\e[6n\e[0dB",
+    .expected_screen = {
+        " B",
+        0
+    },  
+    .expected_serial = "\e[30;2R",
+    .expected_cursor_x = 2,
+    .expected_cursor_y = 0
+};
@@ -108,3 +108,40 @@ TEST_VECTOR test_tab = {
     .expected_cursor_x = 42,
     .expected_cursor_y = 0
 };
+
+TEST_VECTOR test_utf8 = {
+    .name = "utf8",
+    .input_sequence = "\xe2\x94\x8c\xe2\x94\x80\xe2\x94\x90 \xc2\xb0" "C \xe2\x86\x92"
+            "\xe2\x94\x80\e[2b",
+    .expected_screen = {
+        "\xda\xc4\xbf \xf8" "C \x1a\xc4\xc4\xc4",
+        0
+    },  
+    .expected_serial = "",
+    .expected_cursor_x = 11,
+    .expected_cursor_y = 0
+};
+
+TEST_VECTOR test_utf8_invalid = {
+    .name = "utf8 invalid",
+    .input_sequence = "a\xe2\x94" "b\xc0z\xe4\xb8\xadq\xcc\x81!",
+    .expected_screen = {
+        "a?b?z??q!",
+        0
+    },  
+    .expected_serial = "",
+    .expected_cursor_x = 9,
+    .expected_cursor_y = 0
+};
+
+TEST_VECTOR test_utf8_docs = {
+    .name = "utf8 docs",
+    .input_sequence = "\e%@\xc4\e%G\xc3\x84",
+    .expected_screen = {
+        "\xc4\x8e",
+        0
+    },  
+    .expected_serial = "",
+    .expected_cursor_x = 2,
+    .expected_cursor_y = 0
+};
@@ -320,6 +320,20 @@ TEST_VECTOR test_csi_il1 = {
     .expected_cursor_y = 1
 };
 
+TEST_VECTOR test_csi_il2 = {
+    .name = "csi il after scroll",
+    .input_sequence = "Top\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n"
+            "Mid\nBottom\e[A\e[L",
+    .expected_screen = {
+        [0] = "Top",
+        [29] = "      ",
+        [30] = "Mid   ",
+    },
+    .expected_serial = "",
+    .expected_cursor_x = 6,
+    .expected_cursor_y = 28
+};
+
 TEST_VECTOR test_csi_dl1 = {
     .name = "csi dl",
     .input_sequence = "Hello, world!\nLine1\nLine2\nLine3\e[2A\e[2D\e[2M",
@@ -397,6 +411,39 @@ TEST_VECTOR test_csi_sd = {
     .expected_cursor_y = 1
 };
 
+TEST_VECTOR test_csi_decstbm1 = {
+    .name = "csi decstbm lf",
+    .input_sequence = "Top\e[5;1HBot\e[2;4r\e[4;1HA\nB\nC",
+    .expected_screen = {
+        "Top",
+        "A  ",
+        "B  ",
+        "C  ",
+        "Bot",
+        "   ",
+        0
+    },
+    .expected_serial = "",
+    .expected_cursor_x = 1,
+    .expected_cursor_y = 3
+};
+
+TEST_VECTOR test_csi_decstbm2 = {
+    .name = "csi decstbm ri",
+    .input_sequence = "\e[5;1HBot\e[2;4r\e[2;1HA\eMB\e[3;1H\e[L",
+    .expected_screen = {
+        "   ",
+        " B ",
+        "   ",
+        "A  ",
+        "Bot",
+        0
+    },
+    .expected_serial = "",
+    .expected_cursor_x = 0,
+    .expected_cursor_y = 2
+};
+
 TEST_VECTOR test_csi_ech = {
     .name = "csi ech",
     .input_sequence = "Hello, world!\nLine1\nLine2\nLine3\e[2A\e[3D\e[2X",
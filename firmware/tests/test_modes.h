@@ -45,4 +45,15 @@ TEST_VECTOR test_mode_insert2 = {
     .expected_serial = "",
     .expected_cursor_x = 2,
     .expected_cursor_y = 1
-};
\ No newline at end of file
+};
+TEST_VECTOR test_mode_nowrap = {
+    .name = "mode no auto wrap",
+    .input_sequence = "\e[?7l01234567890123456789012345678901234567890123456789012345678901234567890123456789ABCDE",
+    .expected_screen = {
+        "0123456789012345678901234567890123456789012345678901234567890123456789012345678E",
+        0
+    },  
+    .expected_serial = "",
+    .expected_cursor_x = 79,
+    .expected_cursor_y = 0
+};
@@ -0,0 +1,134 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+static TERM_STATE test_history_state;
+
+// Cell x of generated history line n. Lines are 1 to max_len cells long,
+// with blanks in the middle and attribute runs, padded with default blanks
+// that the history trims.
+static TERM_CELL test_history_cell(int n, int x, int max_len) {
+    int len = 1 + (n * 7) % max_len;
+    if (x >= len)
+        return MAKE_CELL(' ', 0, DEFAULT_COLOR);
+    int run = (x / 6 + n) % 4;
+    char flag = (run == 1) ? FLAG_INVERT : (run == 2) ? FLAG_UNDERLINE : 0;
+    char color = (run == 3) ? ((COLOR_GRAY << 4) | COLOR_BLACK) : DEFAULT_COLOR;
+    char c = ((x % 9 == 4) && (x != len - 1)) ? ' ' : 'a' + (n + x) % 26;
+    return MAKE_CELL(c, flag, color);
+}
+
+// Bytes the history takes to store generated line n
+static int test_history_size(int n, int max_len) {
+    int len = 1 + (n * 7) % max_len;
+    int spans = 0;
+    for (int x = 0; x < len; x++) {
+        if ((x == 0) || (CELL_ATTR(test_history_cell(n, x, max_len)) !=
+                CELL_ATTR(test_history_cell(n, x - 1, max_len))))
+            spans++;
+    }
+    return 2 + spans * 3 + len;
+}
+
+// Push count generated lines, then read every kept line back
+static bool test_history_roundtrip(int count, int max_len) {
+    static int sizes[16384];
+    int total = 0;
+    scrollback_clear();
+    for (int n = 0; n < count; n++) {
+        for (int x = 0; x < TERM_WIDTH; x++)
+            term_set_cell(&test_history_state, 0, x,
+                    test_history_cell(n, x, max_len));
+        scrollback_push(&test_history_state, 0);
+        sizes[n] = test_history_size(n, max_len);
+        total += sizes[n];
+    }
+
+    // The newest lines that fit in both limits are kept
+    int kept = 0;
+    int bytes = 0;
+    while ((kept < count) && (kept < SCROLLBACK_MAX_LINES) &&
+            (bytes + sizes[count - 1 - kept] <= SCROLLBACK_SIZE)) {
+        bytes += sizes[count - 1 - kept];
+        kept++;
+    }
+    TEST_CHECK(total > 2 * SCROLLBACK_SIZE);
+    TEST_CHECK(scrollback_lines() == kept);
+
+    for (int i = 0; i < kept; i++) {
+        int n = count - 1 - i;
+        scrollback_get_line(i, &test_history_state, 1);
+        for (int x = 0; x < TERM_WIDTH; x++) {
+            if (term_get_cell(&test_history_state, 1, x) !=
+                    test_history_cell(n, x, max_len)) {
+                printf("Line %d differs at column %d\n", n, x);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Long lines, the ring wraps several times and evicts by size
+static bool test_scrollback_size() {
+    return test_history_roundtrip(1500, TERM_WIDTH);
+}
+
+// Short lines, eviction by line count
+static bool test_scrollback_count() {
+    bool result = test_history_roundtrip(12000, 3);
+    TEST_CHECK(scrollback_lines() == SCROLLBACK_MAX_LINES);
+    return result;
+}
+
+// ED 3 and RIS drop the history, ED 3 leaves the screen alone
+static bool test_scrollback_erase() {
+    term_full_reset();
+    TEST_CHECK(scrollback_lines() == 0);
+    for (int i = 0; i < TERM_HEIGHT + 4; i++)
+        term_process_string("line\r\n");
+    TEST_CHECK(scrollback_lines() == 5);
+    term_process_string("\e[3J");
+    TEST_CHECK(scrollback_lines() == 0);
+    TEST_CHECK(CELL_GLYPH(term_get_cell(term_state_back,
+            term_slot_row(term_state_back, 0), 0)) == 'l');
+    term_process_string("\r\n\r\n");
+    TEST_CHECK(scrollback_lines() == 2);
+    term_process_string("\ec");
+    TEST_CHECK(scrollback_lines() == 0);
+    return true;
+}
+
+TEST_FUNCTION test_scrollback1 = {
+    .name = "scrollback wrap by size",
+    .run = test_scrollback_size
+};
+
+TEST_FUNCTION test_scrollback2 = {
+    .name = "scrollback evict by count",
+    .run = test_scrollback_count
+};
+
+TEST_FUNCTION test_scrollback3 = {
+    .name = "scrollback erase",
+    .run = test_scrollback_erase
+};
@@ -0,0 +1,190 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+// Push text as the newest history line
+static void test_search_push(const char *text) {
+    TERM_CELL blank = MAKE_CELL(' ', 0, DEFAULT_COLOR);
+    term_fill_cells(&test_history_state, 0, 0, TERM_WIDTH, blank);
+    for (int x = 0; text[x]; x++)
+        term_set_cell(&test_history_state, 0, x,
+                MAKE_CELL(text[x], 0, DEFAULT_COLOR));
+    scrollback_push(&test_history_state, 0);
+}
+
+static int test_search_run(const char *pattern) {
+    search_start(pattern, strlen(pattern));
+    while (search_step(term_state_back) == SEARCH_RUNNING);
+    return search_status();
+}
+
+static bool test_search_screen() {
+    term_full_reset();
+    scrollback_clear();
+    test_search_push("needle in history");
+    term_process_string("first\r\nthe needle\r\nlast");
+    TEST_CHECK(test_search_run("needle") == SEARCH_FOUND);
+    TEST_CHECK(!search_hit()->history);
+    TEST_CHECK(search_hit()->line == 1);
+    TEST_CHECK(search_hit()->x == 4);
+    TEST_CHECK(search_hit()->len == 6);
+    // Continues from the screen into the history
+    search_next();
+    while (search_step(term_state_back) == SEARCH_RUNNING);
+    TEST_CHECK(search_status() == SEARCH_FOUND);
+    TEST_CHECK(search_hit()->history);
+    TEST_CHECK(search_hit()->line == scrollback_first());
+    TEST_CHECK(search_hit()->x == 0);
+    search_next();
+    while (search_step(term_state_back) == SEARCH_RUNNING);
+    TEST_CHECK(search_status() == SEARCH_NOT_FOUND);
+    return true;
+}
+
+static bool test_search_history() {
+    char line[TERM_WIDTH];
+    term_full_reset();
+    scrollback_clear();
+    test_search_push("an old needle");
+    for (int i = 0; i < 200; i++) {
+        sprintf(line, "filler line %d", i);
+        test_search_push(line);
+    }
+    search_start("needle", 6);
+    // The screen and the newest history lines take more than one step
+    TEST_CHECK(search_step(term_state_back) == SEARCH_RUNNING);
+    while (search_step(term_state_back) == SEARCH_RUNNING);
+    TEST_CHECK(search_status() == SEARCH_FOUND);
+    TEST_CHECK(search_hit()->history);
+    TEST_CHECK(search_hit()->line == scrollback_first());
+    TEST_CHECK(search_hit()->x == 7);
+    return true;
+}
+
+static bool test_search_case() {
+    term_full_reset();
+    scrollback_clear();
+    test_search_push("History NeEdLe");
+    term_process_string("Hello, World!");
+    TEST_CHECK(test_search_run("wORLD") == SEARCH_FOUND);
+    TEST_CHECK(!search_hit()->history);
+    TEST_CHECK(search_hit()->x == 7);
+    TEST_CHECK(test_search_run("NEEDLE") == SEARCH_FOUND);
+    TEST_CHECK(search_hit()->history);
+    TEST_CHECK(search_hit()->x == 8);
+    return true;
+}
+
+static bool test_search_miss() {
+    term_full_reset();
+    scrollback_clear();
+    test_search_push("abcdef");
+    test_search_push("one two three");
+    // No 'z' in the history, both lines are skipped by the bitmap
+    TEST_CHECK(!(scrollback_line_chars(scrollback_first()) &
+            SCROLLBACK_CHAR_BIT('z')));
+    TEST_CHECK(!(scrollback_line_chars(scrollback_first() + 1) &
+            SCROLLBACK_CHAR_BIT('z')));
+    TEST_CHECK(test_search_run("zed") == SEARCH_NOT_FOUND);
+    // All characters present but not in order
+    TEST_CHECK(test_search_run("fed") == SEARCH_NOT_FOUND);
+    return true;
+}
+
+static bool test_search_last_column() {
+    char line[TERM_WIDTH + 1];
+    term_full_reset();
+    scrollback_clear();
+    memset(line, '-', TERM_WIDTH);
+    memcpy(&line[TERM_WIDTH - 6], "needle", 6);
+    line[TERM_WIDTH] = '\0';
+    test_search_push(line);
+    term_process_string("\e[1;75Hneedle");
+    TEST_CHECK(test_search_run("needle") == SEARCH_FOUND);
+    TEST_CHECK(!search_hit()->history);
+    TEST_CHECK(search_hit()->line == 0);
+    TEST_CHECK(search_hit()->x == TERM_WIDTH - 6);
+    search_next();
+    while (search_step(term_state_back) == SEARCH_RUNNING);
+    TEST_CHECK(search_status() == SEARCH_FOUND);
+    TEST_CHECK(search_hit()->history);
+    TEST_CHECK(search_hit()->x == TERM_WIDTH - 6);
+    // One more character would run past the end of the line
+    TEST_CHECK(test_search_run("needlex") == SEARCH_NOT_FOUND);
+    return true;
+}
+
+static bool test_search_same_line() {
+    term_full_reset();
+    test_search_push("ab ab");
+    term_process_string("xab ab abab");
+    TEST_CHECK(test_search_run("ab") == SEARCH_FOUND);
+    int expected[] = {1, 4, 7, 9};
+    for (int i = 0; i < 4; i++) {
+        TEST_CHECK(!search_hit()->history);
+        TEST_CHECK(search_hit()->line == 0);
+        TEST_CHECK(search_hit()->x == expected[i]);
+        search_next();
+        while (search_step(term_state_back) == SEARCH_RUNNING);
+        TEST_CHECK(search_status() == SEARCH_FOUND);
+    }
+    TEST_CHECK(search_hit()->history);
+    TEST_CHECK(search_hit()->x == 0);
+    search_next();
+    while (search_step(term_state_back) == SEARCH_RUNNING);
+    TEST_CHECK(search_status() == SEARCH_FOUND);
+    TEST_CHECK(search_hit()->x == 3);
+    search_next();
+    while (search_step(term_state_back) == SEARCH_RUNNING);
+    TEST_CHECK(search_status() == SEARCH_NOT_FOUND);
+    return true;
+}
+
+TEST_FUNCTION test_search1 = {
+    .name = "search screen",
+    .run = test_search_screen
+};
+
+TEST_FUNCTION test_search2 = {
+    .name = "search history",
+    .run = test_search_history
+};
+
+TEST_FUNCTION test_search3 = {
+    .name = "search case insensitive",
+    .run = test_search_case
+};
+
+TEST_FUNCTION test_search4 = {
+    .name = "search miss",
+    .run = test_search_miss
+};
+
+TEST_FUNCTION test_search5 = {
+    .name = "search last column",
+    .run = test_search_last_column
+};
+
+TEST_FUNCTION test_search6 = {
+    .name = "search same line",
+    .run = test_search_same_line
+};
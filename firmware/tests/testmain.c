@@ -26,6 +26,9 @@
 #include <stdbool.h>
 #include <termios.h>
 #include "../termcore.h"
+#include "../graphics.h"
+#include "../scrollback.h"
+#include "../search.h"
 #include "tests.h"
 
 char *serial_out;
@@ -35,6 +38,7 @@ void serial_puts(char *string) {
     int len = strlen(string);
     serial_out = realloc(serial_out, serial_out_len + len + 1);
     memcpy(serial_out + serial_out_len, string, len + 1);
+    serial_out_len += len;
 }
 
 bool strcmp_with_null(char *expected, char *actual) {
@@ -59,6 +63,7 @@ bool runtest(TEST_VECTOR *test) {
     term_full_reset();
     if (serial_out) {
         free(serial_out);
+        serial_out = NULL;
     }
     serial_out_len = 0;
     term_process_string(test->input_sequence);
@@ -68,9 +73,14 @@ bool runtest(TEST_VECTOR *test) {
         return false;
     }
     for (int i = 0; i < TERM_BUF_HEIGHT; i++) {
-        if (!strcmp_with_null(test->expected_screen[i], term_state_back->textmap[i])) {
+        char line[TERM_WIDTH + 1];
+        for (int x = 0; x < TERM_WIDTH; x++)
+            line[x] = CELL_GLYPH(term_get_cell(term_state_back,
+                    term_slot_row(term_state_back, i), x));
+        line[TERM_WIDTH] = '\0';
+        if (!strcmp_with_null(test->expected_screen[i], line)) {
             printf("Screen output failed to match on line %d. Expected:\n%s\nGot:\n%s\n",
-                    i, test->expected_screen[i], term_state_back->textmap[i]);
+                    i, test->expected_screen[i], line);
             return false;
         }
     }
@@ -139,7 +149,12 @@ int main(int argc, char *argv[]) {
         bool result = runtest(tests[i]);
         if (result) successCount++; 
     }
-    printf("%d of %d tests passed.\n", successCount, TEST_COUNT);
+    for (int i = 0; i < FUNCTION_TEST_COUNT; i++) {
+        printf("Testing %s...\n", function_tests[i]->name);
+        if (function_tests[i]->run()) successCount++;
+    }
+    printf("%d of %d tests passed.\n", successCount,
+            TEST_COUNT + FUNCTION_TEST_COUNT);
 #else
     runtestOnTerminal(tests[42]);
 #endif
@@ -30,10 +30,25 @@ typedef struct {
     int expected_cursor_y;
 } TEST_VECTOR;
 
+// Tests that drive a module directly instead of feeding an input sequence
+typedef struct {
+    char *name;
+    bool (*run)(void);
+} TEST_FUNCTION;
+
+#define TEST_CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("Check failed on line %d: %s\n", __LINE__, #cond); \
+            return false; \
+        } \
+    } while (0)
+
 #include "test_basics.h"
 #include "test_basic_escape.h"
 #include "test_csi.h"
 #include "test_modes.h"
+#include "test_scrollback.h"
+#include "test_search.h"
 
 TEST_VECTOR *tests[] = {
     &test_text_input,
@@ -43,10 +58,17 @@ TEST_VECTOR *tests[] = {
     &test_wrap2,
     &test_wrap3,
     &test_tab,
+    &test_utf8,
+    &test_utf8_invalid,
+    &test_utf8_docs,
     &test_esc_ind,
     &test_esc_nel,
     &test_esc_ri,
     &test_esc_decscrc,
+    &test_esc_scs,
+    &test_esc_shift,
+    &test_esc_cha_range,
+    &test_esc_vpa_range,
     &test_csi_ich1,
     &test_csi_ich2,
     &test_csi_cuu1,
@@ -69,16 +91,34 @@ TEST_VECTOR *tests[] = {
     &test_csi_el2,
     &test_csi_el3,
     &test_csi_il1,
+    &test_csi_il2,
     &test_csi_dl1,
     &test_csi_dch1,
     &test_csi_dch2,
     &test_csi_su,
     &test_csi_sd,
+    &test_csi_decstbm1,
+    &test_csi_decstbm2,
     &test_csi_ech,
     &test_csi_cbt,
     &test_csi_rep,
     &test_mode_insert1,
-    &test_mode_insert2
+    &test_mode_insert2,
+    &test_mode_nowrap
+};
+
+#define TEST_COUNT (int)(sizeof(tests) / sizeof(TEST_VECTOR *))
+
+TEST_FUNCTION *function_tests[] = {
+    &test_scrollback1,
+    &test_scrollback2,
+    &test_scrollback3,
+    &test_search1,
+    &test_search2,
+    &test_search3,
+    &test_search4,
+    &test_search5,
+    &test_search6
 };
 
-#define TEST_COUNT (int)(sizeof(tests) / sizeof(TEST_VECTOR *))
\ No newline at end of file
+#define FUNCTION_TEST_COUNT (int)(sizeof(function_tests) / sizeof(TEST_FUNCTION *))
@@ -0,0 +1,233 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdint.h>
+#include <stdbool.h>
+#include "unicode.h"
+
+// Glyph of each code point, from the code point of each glyph in font.h
+// (code page 437) plus close glyphs for common code points it lacks.
+// Pages of the table, page 0 is left empty for code points without a glyph
+#define PAGE_00 1
+#define PAGE_01 2
+#define PAGE_03 3
+#define PAGE_20 4
+#define PAGE_21 5
+#define PAGE_22 6
+#define PAGE_23 7
+#define PAGE_25 8
+#define PAGE_26 9
+#define PAGE_27 10
+
+_Static_assert(PAGE_27 < UNICODE_PAGES, "unicode_pages too small");
+
+const uint8_t unicode_page_index[256] = {
+    [0x00] = PAGE_00,
+    [0x01] = PAGE_01,
+    [0x03] = PAGE_03,
+    [0x20] = PAGE_20,
+    [0x21] = PAGE_21,
+    [0x22] = PAGE_22,
+    [0x23] = PAGE_23,
+    [0x25] = PAGE_25,
+    [0x26] = PAGE_26,
+    [0x27] = PAGE_27,
+};
+
+const uint8_t unicode_pages[UNICODE_PAGES][256] = {
+    // U+00xx Latin-1
+    [PAGE_00] = {
+        [0x20] = 0x20, [0x21] = 0x21, [0x22] = 0x22, [0x23] = 0x23,
+        [0x24] = 0x24, [0x25] = 0x25, [0x26] = 0x26, [0x27] = 0x27,
+        [0x28] = 0x28, [0x29] = 0x29, [0x2a] = 0x2a, [0x2b] = 0x2b,
+        [0x2c] = 0x2c, [0x2d] = 0x2d, [0x2e] = 0x2e, [0x2f] = 0x2f,
+        [0x30] = 0x30, [0x31] = 0x31, [0x32] = 0x32, [0x33] = 0x33,
+        [0x34] = 0x34, [0x35] = 0x35, [0x36] = 0x36, [0x37] = 0x37,
+        [0x38] = 0x38, [0x39] = 0x39, [0x3a] = 0x3a, [0x3b] = 0x3b,
+        [0x3c] = 0x3c, [0x3d] = 0x3d, [0x3e] = 0x3e, [0x3f] = 0x3f,
+        [0x40] = 0x40, [0x41] = 0x41, [0x42] = 0x42, [0x43] = 0x43,
+        [0x44] = 0x44, [0x45] = 0x45, [0x46] = 0x46, [0x47] = 0x47,
+        [0x48] = 0x48, [0x49] = 0x49, [0x4a] = 0x4a, [0x4b] = 0x4b,
+        [0x4c] = 0x4c, [0x4d] = 0x4d, [0x4e] = 0x4e, [0x4f] = 0x4f,
+        [0x50] = 0x50, [0x51] = 0x51, [0x52] = 0x52, [0x53] = 0x53,
+        [0x54] = 0x54, [0x55] = 0x55, [0x56] = 0x56, [0x57] = 0x57,
+        [0x58] = 0x58, [0x59] = 0x59, [0x5a] = 0x5a, [0x5b] = 0x5b,
+        [0x5c] = 0x5c, [0x5d] = 0x5d, [0x5e] = 0x5e, [0x5f] = 0x5f,
+        [0x60] = 0x60, [0x61] = 0x61, [0x62] = 0x62, [0x63] = 0x63,
+        [0x64] = 0x64, [0x65] = 0x65, [0x66] = 0x66, [0x67] = 0x67,
+        [0x68] = 0x68, [0x69] = 0x69, [0x6a] = 0x6a, [0x6b] = 0x6b,
+        [0x6c] = 0x6c, [0x6d] = 0x6d, [0x6e] = 0x6e, [0x6f] = 0x6f,
+        [0x70] = 0x70, [0x71] = 0x71, [0x72] = 0x72, [0x73] = 0x73,
+        [0x74] = 0x74, [0x75] = 0x75, [0x76] = 0x76, [0x77] = 0x77,
+        [0x78] = 0x78, [0x79] = 0x79, [0x7a] = 0x7a, [0x7b] = 0x7b,
+        [0x7c] = 0x7c, [0x7d] = 0x7d, [0x7e] = 0x7e, [0xa0] = 0xff,
+        [0xa1] = 0xad, [0xa2] = 0x9b, [0xa3] = 0x9c, [0xa5] = 0x9d,
+        [0xa6] = 0x7c, [0xa7] = 0x15, [0xaa] = 0xa6, [0xab] = 0xae,
+        [0xac] = 0xaa, [0xb0] = 0xf8, [0xb1] = 0xf1, [0xb2] = 0xfd,
+        [0xb5] = 0xe6, [0xb6] = 0x14, [0xb7] = 0xfa, [0xba] = 0xa7,
+        [0xbb] = 0xaf, [0xbc] = 0xac, [0xbd] = 0xab, [0xbf] = 0xa8,
+        [0xc4] = 0x8e, [0xc5] = 0x8f, [0xc6] = 0x92, [0xc7] = 0x80,
+        [0xc9] = 0x90, [0xd1] = 0xa5, [0xd6] = 0x99, [0xdc] = 0x9a,
+        [0xdf] = 0xe1, [0xe0] = 0x85, [0xe1] = 0xa0, [0xe2] = 0x83,
+        [0xe4] = 0x84, [0xe5] = 0x86, [0xe6] = 0x91, [0xe7] = 0x87,
+        [0xe8] = 0x8a, [0xe9] = 0x82, [0xea] = 0x88, [0xeb] = 0x89,
+        [0xec] = 0x8d, [0xed] = 0xa1, [0xee] = 0x8c, [0xef] = 0x8b,
+        [0xf1] = 0xa4, [0xf2] = 0x95, [0xf3] = 0xa2, [0xf4] = 0x93,
+        [0xf6] = 0x94, [0xf7] = 0xf6, [0xf9] = 0x97, [0xfa] = 0xa3,
+        [0xfb] = 0x96, [0xfc] = 0x81, [0xff] = 0x98,
+    },
+    // U+01xx Latin Extended-B
+    [PAGE_01] = {
+        [0x92] = 0x9f,
+    },
+    // U+03xx Greek
+    [PAGE_03] = {
+        [0x93] = 0xe2, [0x98] = 0xe9, [0xa3] = 0xe4, [0xa6] = 0xe8,
+        [0xa9] = 0xea, [0xb1] = 0xe0, [0xb2] = 0xe1, [0xb4] = 0xeb,
+        [0xb5] = 0xee, [0xc0] = 0xe3, [0xc3] = 0xe5, [0xc4] = 0xe7,
+        [0xc6] = 0xed,
+    },
+    // U+20xx General Punctuation, currency and super/subscripts. Typographic
+    // quotes and dashes are drawn with their ASCII forms.
+    [PAGE_20] = {
+        [0x10] = 0x2d, [0x11] = 0x2d, [0x12] = 0x2d, [0x13] = 0x2d,
+        [0x14] = 0x2d, [0x15] = 0x2d, [0x18] = 0x27, [0x19] = 0x27,
+        [0x1a] = 0x27, [0x1b] = 0x27, [0x1c] = 0x22, [0x1d] = 0x22,
+        [0x1e] = 0x22, [0x1f] = 0x22, [0x22] = 0x07, [0x32] = 0x27,
+        [0x33] = 0x22, [0x39] = 0x3c, [0x3a] = 0x3e, [0x3c] = 0x13,
+        [0x7f] = 0xfc, [0xa7] = 0x9e,
+    },
+    // U+21xx Arrows
+    [PAGE_21] = {
+        [0x26] = 0xea, [0x90] = 0x1b, [0x91] = 0x18, [0x92] = 0x1a,
+        [0x93] = 0x19, [0x94] = 0x1d, [0x95] = 0x12, [0xa8] = 0x17,
+    },
+    // U+22xx Mathematical Operators
+    [PAGE_22] = {
+        [0x05] = 0xed, [0x08] = 0xee, [0x12] = 0x2d, [0x15] = 0x2f,
+        [0x19] = 0xf9, [0x1a] = 0xfb, [0x1e] = 0xec, [0x1f] = 0x1c,
+        [0x29] = 0xef, [0x48] = 0xf7, [0x61] = 0xf0, [0x64] = 0xf3,
+        [0x65] = 0xf2,
+    },
+    // U+23xx Miscellaneous Technical
+    [PAGE_23] = {
+        [0x02] = 0x7f, [0x10] = 0xa9, [0x20] = 0xf4, [0x21] = 0xf5,
+        [0xba] = 0xc4, [0xbb] = 0xc4, [0xbc] = 0xc4, [0xbd] = 0x5f,
+    },
+    // U+25xx Box Drawing, Block Elements and Geometric Shapes. Heavy, dashed
+    // and rounded lines are drawn with the light ones.
+    [PAGE_25] = {
+        [0x00] = 0xc4, [0x01] = 0xc4, [0x02] = 0xb3, [0x03] = 0xb3,
+        [0x04] = 0xc4, [0x05] = 0xc4, [0x06] = 0xb3, [0x07] = 0xb3,
+        [0x08] = 0xc4, [0x09] = 0xc4, [0x0a] = 0xb3, [0x0b] = 0xb3,
+        [0x0c] = 0xda, [0x0d] = 0xda, [0x0e] = 0xda, [0x0f] = 0xda,
+        [0x10] = 0xbf, [0x11] = 0xbf, [0x12] = 0xbf, [0x13] = 0xbf,
+        [0x14] = 0xc0, [0x15] = 0xc0, [0x16] = 0xc0, [0x17] = 0xc0,
+        [0x18] = 0xd9, [0x19] = 0xd9, [0x1a] = 0xd9, [0x1b] = 0xd9,
+        [0x1c] = 0xc3, [0x1d] = 0xc3, [0x1e] = 0xc3, [0x1f] = 0xc3,
+        [0x20] = 0xc3, [0x21] = 0xc3, [0x22] = 0xc3, [0x23] = 0xc3,
+        [0x24] = 0xb4, [0x25] = 0xb4, [0x26] = 0xb4, [0x27] = 0xb4,
+        [0x28] = 0xb4, [0x29] = 0xb4, [0x2a] = 0xb4, [0x2b] = 0xb4,
+        [0x2c] = 0xc2, [0x2d] = 0xc2, [0x2e] = 0xc2, [0x2f] = 0xc2,
+        [0x30] = 0xc2, [0x31] = 0xc2, [0x32] = 0xc2, [0x33] = 0xc2,
+        [0x34] = 0xc1, [0x35] = 0xc1, [0x36] = 0xc1, [0x37] = 0xc1,
+        [0x38] = 0xc1, [0x39] = 0xc1, [0x3a] = 0xc1, [0x3b] = 0xc1,
+        [0x3c] = 0xc5, [0x3d] = 0xc5, [0x3e] = 0xc5, [0x3f] = 0xc5,
+        [0x40] = 0xc5, [0x41] = 0xc5, [0x42] = 0xc5, [0x43] = 0xc5,
+        [0x44] = 0xc5, [0x45] = 0xc5, [0x46] = 0xc5, [0x47] = 0xc5,
+        [0x48] = 0xc5, [0x49] = 0xc5, [0x4a] = 0xc5, [0x4b] = 0xc5,
+        [0x4c] = 0xc4, [0x4d] = 0xc4, [0x4e] = 0xb3, [0x4f] = 0xb3,
+        [0x50] = 0xcd, [0x51] = 0xba, [0x52] = 0xd5, [0x53] = 0xd6,
+        [0x54] = 0xc9, [0x55] = 0xb8, [0x56] = 0xb7, [0x57] = 0xbb,
+        [0x58] = 0xd4, [0x59] = 0xd3, [0x5a] = 0xc8, [0x5b] = 0xbe,
+        [0x5c] = 0xbd, [0x5d] = 0xbc, [0x5e] = 0xc6, [0x5f] = 0xc7,
+        [0x60] = 0xcc, [0x61] = 0xb5, [0x62] = 0xb6, [0x63] = 0xb9,
+        [0x64] = 0xd1, [0x65] = 0xd2, [0x66] = 0xcb, [0x67] = 0xcf,
+        [0x68] = 0xd0, [0x69] = 0xca, [0x6a] = 0xd8, [0x6b] = 0xd7,
+        [0x6c] = 0xce, [0x6d] = 0xda, [0x6e] = 0xbf, [0x6f] = 0xd9,
+        [0x70] = 0xc0, [0x74] = 0xc4, [0x75] = 0xb3, [0x76] = 0xc4,
+        [0x77] = 0xb3, [0x78] = 0xc4, [0x79] = 0xb3, [0x7a] = 0xc4,
+        [0x7b] = 0xb3, [0x7c] = 0xc4, [0x7d] = 0xb3, [0x7e] = 0xc4,
+        [0x7f] = 0xb3, [0x80] = 0xdf, [0x84] = 0xdc, [0x88] = 0xdb,
+        [0x8c] = 0xdd, [0x90] = 0xde, [0x91] = 0xb0, [0x92] = 0xb1,
+        [0x93] = 0xb2, [0xa0] = 0xfe, [0xaa] = 0xfe, [0xac] = 0x16,
+        [0xb2] = 0x1e, [0xb4] = 0x1e, [0xb6] = 0x10, [0xb8] = 0x10,
+        [0xba] = 0x10, [0xbc] = 0x1f, [0xbe] = 0x1f, [0xc0] = 0x11,
+        [0xc2] = 0x11, [0xc4] = 0x11, [0xc6] = 0x04, [0xcb] = 0x09,
+        [0xcf] = 0x07, [0xd8] = 0x08, [0xd9] = 0x0a,
+    },
+    // U+26xx Miscellaneous Symbols
+    [PAGE_26] = {
+        [0x3a] = 0x01, [0x3b] = 0x02, [0x3c] = 0x0f, [0x40] = 0x0c,
+        [0x42] = 0x0b, [0x60] = 0x06, [0x63] = 0x05, [0x65] = 0x03,
+        [0x66] = 0x04, [0x6a] = 0x0d, [0x6b] = 0x0e,
+    },
+    // U+27xx Dingbats
+    [PAGE_27] = {
+        [0x13] = 0xfb, [0x14] = 0xfb,
+    },
+};
+
+// Code points without a glyph that take no column, and that take two
+static const uint32_t unicode_zero_width[][2] = {
+    {0x0300, 0x036f},
+    {0x200b, 0x200f},
+    {0x2060, 0x2064},
+    {0xfe00, 0xfe0f},
+    {0xfeff, 0xfeff},
+};
+
+static const uint32_t unicode_wide[][2] = {
+    {0x1100, 0x115f},
+    {0x2e80, 0x303e},
+    {0x3041, 0x33ff},
+    {0x3400, 0x4dbf},
+    {0x4e00, 0x9fff},
+    {0xa000, 0xa4cf},
+    {0xac00, 0xd7a3},
+    {0xf900, 0xfaff},
+    {0xfe30, 0xfe4f},
+    {0xff00, 0xff60},
+    {0xffe0, 0xffe6},
+    {0x1f300, 0x1f64f},
+    {0x1f900, 0x1f9ff},
+    {0x20000, 0x3fffd},
+};
+
+#define ARRAY_LEN(a) (int)(sizeof(a) / sizeof(a[0]))
+
+static bool unicode_in_ranges(uint32_t cp, const uint32_t (*ranges)[2],
+        int count) {
+    for (int i = 0; i < count; i++) {
+        if ((cp >= ranges[i][0]) && (cp <= ranges[i][1]))
+            return true;
+    }
+    return false;
+}
+
+int unicode_width(uint32_t cp) {
+    if (unicode_in_ranges(cp, unicode_zero_width,
+            ARRAY_LEN(unicode_zero_width)))
+        return 0;
+    if (unicode_in_ranges(cp, unicode_wide, ARRAY_LEN(unicode_wide)))
+        return 2;
+    return 1;
+}
@@ -0,0 +1,45 @@
+//
+// Copyright 2021 Wenting Zhang <zephray@outlook.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+#include <stdint.h>
+
+// Code points are drawn with the 256 glyphs of the code page 437 font. The
+// lookup goes through a constant page table: unicode_page_index picks one
+// of the 256 entry pages for the upper bits of the code point, page 0 is
+// all zero for code points without a glyph.
+#define UNICODE_PAGES 11
+// Glyph drawn for code points that are not in the font
+#define UNICODE_REPLACEMENT '?'
+
+extern const uint8_t unicode_page_index[256];
+extern const uint8_t unicode_pages[UNICODE_PAGES][256];
+
+// Columns taken by a code point without a glyph: 0, 1 or 2
+int unicode_width(uint32_t cp);
+
+// Glyph of code point cp, 0 if the font does not have one
+static inline uint8_t unicode_to_glyph(uint32_t cp) {
+    if (cp >= 0x10000)
+        return 0;
+    return unicode_pages[unicode_page_index[cp >> 8]][cp & 0xff];
+}